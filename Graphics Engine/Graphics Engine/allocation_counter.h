@@ -0,0 +1,88 @@
+//
+//  allocation_counter.h
+//  Graphics Engine
+//
+//  Copyright © 2017 Tony. All rights reserved.
+//
+
+#ifndef allocation_counter_h
+#define allocation_counter_h
+
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+// Counts the heap allocations each thread makes, by replacing the global operator new. Include it in one
+// translation unit only (the replacements must be defined once per program).
+namespace AllocationCounter {
+
+    inline uint64_t& threadCount()
+    {
+        static thread_local uint64_t count = 0;
+        return count;
+    }
+
+    // allocations made on the calling thread so far, compare two readings to count the ones in between
+    inline uint64_t count()
+    {
+        return threadCount();
+    }
+}
+
+void* operator new(std::size_t size)
+{
+    AllocationCounter::threadCount()++;
+    void* pointer = std::malloc(size ? size : 1);
+    if (!pointer)
+        throw std::bad_alloc();
+    return pointer;
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    AllocationCounter::threadCount()++;
+    return std::malloc(size ? size : 1);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    return operator new(size, std::nothrow);
+}
+
+void operator delete(void* pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept
+{
+    std::free(pointer);
+}
+
+// sized and nothrow deletes (C++14 calls the sized ones for complete types), so none falls back to the library's
+void operator delete(void* pointer, std::size_t) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, const std::nothrow_t&) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept
+{
+    std::free(pointer);
+}
+
+#endif /* allocation_counter_h */
@@ -0,0 +1,248 @@
+//
+//  benchmark.h
+//  Graphics Engine
+//
+//  Copyright © 2017 Tony. All rights reserved.
+//
+
+#ifndef benchmark_h
+#define benchmark_h
+
+#include <glad/glad.h>
+
+#include "gl_state.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Command line options of the headless benchmark mode:
+//   --benchmark [frames]   render a fixed number of frames offscreen and exit (default 500)
+//   --warmup <frames>      frames rendered before recording starts (default 30)
+//   --out <file>           per-frame timings, written as JSON if the name ends in .json, CSV otherwise
+//   --trace <file>         record per-pass CPU/GPU scopes and write them as Chrome trace JSON (also without --benchmark)
+//   --upload-budget <MB>   texture data streamed to the GPU per frame at most (default 4)
+//   --packed-vertices      quantize model vertices (see VertexLayout), 24 instead of 56 bytes with all attributes
+//   --depth-prepass        keep model positions in a stream of their own and lay down model depth before shading
+//   --raw-textures         upload textures uncompressed instead of block compressed
+//   --lod-error <pixels>   screen-space error model levels of detail may show (default 1, 0 draws full detail)
+struct BenchmarkOptions {
+    bool enabled;
+    int frames;
+    int warmupFrames;
+    std::string outputPath;
+    std::string tracePath;
+    float uploadBudgetMB;
+    bool packedVertices;
+    bool depthPrepass;
+    bool rawTextures;
+    float lodErrorPixels;
+
+    BenchmarkOptions() : enabled(false), frames(500), warmupFrames(30), outputPath("benchmark.csv"), uploadBudgetMB(4.0f), packedVertices(false), depthPrepass(false), rawTextures(false), lodErrorPixels(1.0f) {}
+};
+
+BenchmarkOptions parseBenchmarkOptions(int argc, char** argv)
+{
+    BenchmarkOptions options;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--benchmark") == 0)
+        {
+            options.enabled = true;
+            if (i + 1 < argc && std::atoi(argv[i + 1]) > 0)
+                options.frames = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--warmup") == 0 && i + 1 < argc)
+            options.warmupFrames = std::max(0, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+            options.outputPath = argv[++i];
+        else if (std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+            options.tracePath = argv[++i];
+        else if (std::strcmp(argv[i], "--upload-budget") == 0 && i + 1 < argc)
+            options.uploadBudgetMB = (float)std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--packed-vertices") == 0)
+            options.packedVertices = true;
+        else if (std::strcmp(argv[i], "--depth-prepass") == 0)
+            options.depthPrepass = true;
+        else if (std::strcmp(argv[i], "--raw-textures") == 0)
+            options.rawTextures = true;
+        else if (std::strcmp(argv[i], "--lod-error") == 0 && i + 1 < argc)
+            options.lodErrorPixels = std::max(0.0f, (float)std::atof(argv[++i]));
+    }
+    return options;
+}
+
+// Records CPU and GPU time of every frame. GPU time is measured with GL_TIMESTAMP queries (so it doesn't interfere
+// with GL_TIME_ELAPSED queries issued inside the frame) and read back a few frames later, so it never stalls the pipeline.
+// Given a heap allocation counter (see AllocationCounter) it also records the allocations each frame makes on the
+// render thread, which must be none once nothing is loading any more (see allocationFree), and the GL state calls
+// GLState passed on to the driver and dropped.
+class FrameBenchmark
+{
+public:
+    struct FrameTiming {
+        double cpuMs;
+        double gpuMs;
+        uint64_t allocations;
+        bool steady;                // nothing was loading, the frame must not allocate
+        unsigned int stateCalls;    // reached the driver
+        unsigned int stateFiltered; // dropped as redundant
+    };
+
+    FrameBenchmark(int warmupFrames, int frames, uint64_t (*allocationCount)() = NULL)
+        : warmupFrames(warmupFrames), frameIndex(0), allocationCount(allocationCount), allocationStart(0), frameSteady(true)
+    {
+        timings.reserve(frames); // recording a frame must not allocate either
+        glGenQueries(2 * QUERY_LATENCY, queries);
+        for (int i = 0; i < QUERY_LATENCY; i++)
+            pendingFrame[i] = -1;
+    }
+
+    ~FrameBenchmark()
+    {
+        glDeleteQueries(2 * QUERY_LATENCY, queries);
+    }
+
+    // `steady` tells that nothing is loading (textures streaming in) during the frame
+    void beginFrame(bool steady = true)
+    {
+        int slot = frameIndex % QUERY_LATENCY;
+        // the slot still holds a frame from QUERY_LATENCY frames ago, its result is ready by now
+        if (pendingFrame[slot] >= 0)
+            resolve(slot);
+        glQueryCounter(queries[2 * slot], GL_TIMESTAMP);
+        cpuStart = std::chrono::high_resolution_clock::now();
+        if (allocationCount)
+            allocationStart = allocationCount();
+        frameSteady = steady;
+    }
+
+    void endFrame()
+    {
+        int slot = frameIndex % QUERY_LATENCY;
+        glQueryCounter(queries[2 * slot + 1], GL_TIMESTAMP);
+        double cpuMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - cpuStart).count();
+        uint64_t allocations = allocationCount ? allocationCount() - allocationStart : 0;
+        if (frameIndex >= warmupFrames)
+        {
+            const GLState::Counters &state = GLState::instance().frameCounters();
+            FrameTiming timing = { cpuMs, 0.0, allocations, frameSteady, state.issued, state.filtered };
+            timings.push_back(timing);
+            pendingFrame[slot] = (int)timings.size() - 1;
+        }
+        frameIndex++;
+    }
+
+    // reads back the outstanding queries, call once after the last frame
+    void finish()
+    {
+        for (int i = 0; i < QUERY_LATENCY; i++)
+            if (pendingFrame[i] >= 0)
+                resolve(i);
+    }
+
+    // false if a steady recorded frame allocated, always true without an allocation counter
+    bool allocationFree() const
+    {
+        for (size_t i = 0; i < timings.size(); i++)
+            if (timings[i].steady && timings[i].allocations > 0)
+                return false;
+        return true;
+    }
+
+    // writes one row per recorded frame and prints a summary
+    bool write(const std::string &path) const
+    {
+        std::ofstream file(path.c_str());
+        if (!file)
+        {
+            std::cout << "ERROR::BENCHMARK:: Could not open " << path << std::endl;
+            return false;
+        }
+        bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+        if (json)
+        {
+            file << "{\n  \"frames\": [\n";
+            for (size_t i = 0; i < timings.size(); i++)
+                file << "    { \"frame\": " << i << ", \"cpu_ms\": " << timings[i].cpuMs << ", \"gpu_ms\": " << timings[i].gpuMs
+                     << ", \"allocations\": " << timings[i].allocations << ", \"state_calls\": " << timings[i].stateCalls
+                     << ", \"state_filtered\": " << timings[i].stateFiltered << " }" << (i + 1 < timings.size() ? ",\n" : "\n");
+            file << "  ]\n}\n";
+        }
+        else
+        {
+            file << "frame,cpu_ms,gpu_ms,allocations,state_calls,state_filtered\n";
+            for (size_t i = 0; i < timings.size(); i++)
+                file << i << "," << timings[i].cpuMs << "," << timings[i].gpuMs << "," << timings[i].allocations
+                     << "," << timings[i].stateCalls << "," << timings[i].stateFiltered << "\n";
+        }
+
+        std::vector<double> cpu, gpu;
+        uint64_t allocations = 0, maxAllocations = 0, steadyAllocations = 0, stateCalls = 0, stateFiltered = 0;
+        for (size_t i = 0; i < timings.size(); i++)
+        {
+            cpu.push_back(timings[i].cpuMs);
+            gpu.push_back(timings[i].gpuMs);
+            allocations += timings[i].allocations;
+            maxAllocations = std::max(maxAllocations, timings[i].allocations);
+            if (timings[i].steady)
+                steadyAllocations += timings[i].allocations;
+            stateCalls += timings[i].stateCalls;
+            stateFiltered += timings[i].stateFiltered;
+        }
+        std::cout << "BENCHMARK:: " << timings.size() << " frames written to " << path << std::endl;
+        printSummary("cpu", cpu);
+        printSummary("gpu", gpu);
+        if (allocationCount)
+            std::cout << "  heap allocations: " << allocations << " in total, at most " << maxAllocations << " in a frame, "
+                      << steadyAllocations << " in frames without loading" << std::endl;
+        if (!timings.empty())
+            std::cout << "  GL state calls per frame: " << stateCalls / timings.size() << " issued, "
+                      << stateFiltered / timings.size() << " filtered as redundant" << std::endl;
+        return true;
+    }
+
+private:
+    static const int QUERY_LATENCY = 4;
+
+    int warmupFrames;
+    int frameIndex;
+    unsigned int queries[2 * QUERY_LATENCY];
+    int pendingFrame[QUERY_LATENCY]; // index into timings per query slot, -1 if the slot holds nothing to record
+    std::chrono::high_resolution_clock::time_point cpuStart;
+    std::vector<FrameTiming> timings;
+    uint64_t (*allocationCount)(); // allocations made on the render thread so far, NULL if not counted
+    uint64_t allocationStart;
+    bool frameSteady;
+
+    void resolve(int slot)
+    {
+        GLuint64 begin = 0, end = 0;
+        glGetQueryObjectui64v(queries[2 * slot], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(queries[2 * slot + 1], GL_QUERY_RESULT, &end);
+        timings[pendingFrame[slot]].gpuMs = (end - begin) / 1.0e6;
+        pendingFrame[slot] = -1;
+    }
+
+    static void printSummary(const char* name, std::vector<double> values)
+    {
+        if (values.empty())
+            return;
+        std::sort(values.begin(), values.end());
+        double sum = 0.0;
+        for (size_t i = 0; i < values.size(); i++)
+            sum += values[i];
+        std::cout << "  " << name << " ms: mean " << sum / values.size()
+                  << "  median " << values[values.size() / 2]
+                  << "  p99 " << values[std::min(values.size() - 1, values.size() * 99 / 100)]
+                  << "  max " << values.back() << std::endl;
+    }
+};
+
+#endif /* benchmark_h */
@@ -0,0 +1,368 @@
+//
+//  buffer_arena.h
+//  Graphics Engine
+//
+//  Copyright © 2017 Tony. All rights reserved.
+//
+
+#ifndef buffer_arena_h
+#define buffer_arena_h
+
+#include <glad/glad.h>
+
+#include "gl_state.h"
+#include "vertex_format.h"
+
+#include <algorithm>
+#include <map>
+#include <vector>
+using namespace std;
+
+// space reserved when an arena is first used, it grows by doubling from there
+const size_t ARENA_INITIAL_VERTICES = 65536;
+const size_t ARENA_INITIAL_INDEX_BYTES = 256 * 1024;
+
+// Hands out ranges of a buffer of `size()` units, first fit. Freed ranges merge with their free neighbors.
+class RangeAllocator
+{
+public:
+    RangeAllocator() : capacity(0) {}
+
+    size_t size() const
+    {
+        return capacity;
+    }
+
+    // a range of `count` units starting at a multiple of `alignment`, false if no free range is large enough
+    bool allocate(size_t count, size_t alignment, size_t &offset)
+    {
+        if (count == 0)
+        {
+            offset = 0;
+            return true;
+        }
+        for (map<size_t, size_t>::iterator it = freeRanges.begin(); it != freeRanges.end(); ++it)
+        {
+            size_t begin = it->first, end = it->first + it->second;
+            size_t start = (begin + alignment - 1) / alignment * alignment;
+            if (start + count > end)
+                continue;
+            freeRanges.erase(it);
+            if (start > begin)
+                freeRanges[begin] = start - begin;
+            if (start + count < end)
+                freeRanges[start + count] = end - start - count;
+            offset = start;
+            return true;
+        }
+        return false;
+    }
+
+    void free(size_t offset, size_t count)
+    {
+        if (count == 0)
+            return;
+        map<size_t, size_t>::iterator next = freeRanges.lower_bound(offset);
+        if (next != freeRanges.end() && next->first == offset + count)
+        {
+            count += next->second;
+            freeRanges.erase(next++);
+        }
+        if (next != freeRanges.begin())
+        {
+            map<size_t, size_t>::iterator previous = next;
+            --previous;
+            if (previous->first + previous->second == offset)
+            {
+                previous->second += count;
+                return;
+            }
+        }
+        freeRanges[offset] = count;
+    }
+
+    // appends free space up to `newCapacity` units
+    void grow(size_t newCapacity)
+    {
+        if (newCapacity <= capacity)
+            return;
+        size_t added = newCapacity - capacity;
+        size_t offset = capacity;
+        capacity = newCapacity;
+        free(offset, added);
+    }
+
+private:
+    size_t capacity;
+    map<size_t, size_t> freeRanges; // offset -> length
+};
+
+// The vertices and indices of all meshes with the same vertex layout, suballocated from one vertex buffer (plus one
+// for the positions when they are split off, see meshPositionStreams), one index buffer and one vertex array set up
+// for the layout. Meshes draw with their first vertex as base vertex and their indices' byte offset, so drawing one
+// after another needs no buffer or vertex array binds in between. The buffers grow by copying on the GPU; the
+// vertex arrays stay the same objects.
+class VertexArena
+{
+public:
+    // where a mesh's data lives in the arena
+    struct Allocation {
+        size_t firstVertex;
+        size_t vertexCount;
+        size_t indexOffset; // in bytes
+        size_t indexBytes;
+    };
+
+    unsigned int VAO;         // all attributes
+    unsigned int positionVAO; // positions only, VAO itself unless the positions are split off
+
+    VertexArena(unsigned int attributes, VertexFormat format, bool splitPositions)
+        : VBO(0), positionVBO(0), EBO(0), split(splitPositions)
+    {
+        layout = vertexLayout(attributes, format, !split);
+        positionLayout = vertexLayout(0, format);
+        glGenVertexArrays(1, &VAO);
+        positionVAO = VAO;
+        if (split)
+            glGenVertexArrays(1, &positionVAO);
+    }
+
+    // bytes a vertex takes in the attribute stream and in the split off position stream (0 unless split)
+    size_t vertexStride() const
+    {
+        return layout.stride;
+    }
+
+    size_t positionStride() const
+    {
+        return split ? positionLayout.stride : 0;
+    }
+
+    // lays a mesh's vertices out for the arena, as the attribute stream (`vertexStride()` bytes a vertex) and, if
+    // `positions` isn't NULL, the split off position stream (`positionStride()` bytes a vertex)
+    void layOut(const Vertex* vertices, size_t count, const PositionQuantization &quantization, unsigned char* attributes, unsigned char* positions) const
+    {
+        if (layout.stride > 0)
+            layout.writeVertices(vertices, count, quantization, attributes);
+        if (positions)
+            positionLayout.writeVertices(vertices, count, quantization, positions);
+    }
+
+    // copies a mesh's vertices, laid out for the arena, and indices (already in their final width) into the arena
+    Allocation allocate(const Vertex* vertices, size_t vertexCount, const void* indices, size_t indexBytes, const PositionQuantization &quantization)
+    {
+        Allocation allocation = reserve(vertexCount, indexBytes);
+        // GL_COPY_WRITE_BUFFER isn't vertex array state, uploading through it leaves every vertex array as it was
+        if (layout.stride > 0)
+            upload(VBO, layout, vertices, vertexCount, allocation.firstVertex, quantization);
+        if (split)
+            upload(positionVBO, positionLayout, vertices, vertexCount, allocation.firstVertex, quantization);
+        uploadIndices(allocation, indices);
+        return allocation;
+    }
+
+    // the same for vertices already laid out as layOut() does, e.g. read from the mesh cache: they are uploaded as
+    // they are
+    Allocation allocate(const void* attributes, const void* positions, size_t vertexCount, const void* indices, size_t indexBytes)
+    {
+        Allocation allocation = reserve(vertexCount, indexBytes);
+        if (layout.stride > 0 && vertexCount > 0)
+        {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, VBO);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, allocation.firstVertex * layout.stride, vertexCount * layout.stride, attributes);
+        }
+        if (split && vertexCount > 0)
+        {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, positionVBO);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, allocation.firstVertex * positionLayout.stride, vertexCount * positionLayout.stride, positions);
+        }
+        uploadIndices(allocation, indices);
+        return allocation;
+    }
+
+    void free(const Allocation &allocation)
+    {
+        vertexRanges.free(allocation.firstVertex, allocation.vertexCount);
+        indexRanges.free(allocation.indexOffset, allocation.indexBytes);
+    }
+
+    // frees the buffers and vertex arrays
+    void Delete()
+    {
+        if (positionVAO != VAO)
+            GLState::instance().deleteVertexArray(positionVAO);
+        GLState::instance().deleteVertexArray(VAO);
+        glDeleteBuffers(1, &VBO);
+        glDeleteBuffers(1, &positionVBO);
+        glDeleteBuffers(1, &EBO);
+    }
+
+private:
+    unsigned int VBO, positionVBO, EBO; // VBO only when there is more than the split off positions
+    bool split;
+    VertexLayoutInfo layout;          // of VBO
+    VertexLayoutInfo positionLayout;  // of positionVBO
+    RangeAllocator vertexRanges;      // in vertices, the same range in VBO and positionVBO
+    RangeAllocator indexRanges;       // in bytes
+
+    // space for a mesh, growing the buffers if there is none
+    Allocation reserve(size_t vertexCount, size_t indexBytes)
+    {
+        Allocation allocation;
+        allocation.vertexCount = vertexCount;
+        allocation.indexBytes = indexBytes;
+        if (!vertexRanges.allocate(vertexCount, 1, allocation.firstVertex))
+        {
+            growVertices(vertexCount);
+            vertexRanges.allocate(vertexCount, 1, allocation.firstVertex);
+        }
+        // 4 byte aligned so both 16 and 32-bit indices can start anywhere
+        if (!indexRanges.allocate(indexBytes, 4, allocation.indexOffset))
+        {
+            growIndices(indexBytes);
+            indexRanges.allocate(indexBytes, 4, allocation.indexOffset);
+        }
+        return allocation;
+    }
+
+    void uploadIndices(const Allocation &allocation, const void* indices)
+    {
+        if (allocation.indexBytes == 0)
+            return;
+        glBindBuffer(GL_COPY_WRITE_BUFFER, EBO);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, allocation.indexOffset, allocation.indexBytes, indices);
+    }
+
+    // lays the vertices out straight into the buffer range. vertices that need no layout are uploaded as they are
+    static void upload(unsigned int buffer, const VertexLayoutInfo &layout, const Vertex* vertices, size_t count, size_t firstVertex,
+                       const PositionQuantization &quantization)
+    {
+        if (count == 0)
+            return;
+        size_t offset = firstVertex * layout.stride, size = count * layout.stride;
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        if (layout.identity)
+        {
+            glBufferSubData(GL_COPY_WRITE_BUFFER, offset, size, vertices);
+            return;
+        }
+        unsigned char* mapped = (unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, offset, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+        if (mapped)
+        {
+            layout.writeVertices(vertices, count, quantization, mapped);
+            // false if the buffer's contents were lost while it was mapped, then upload them again
+            if (glUnmapBuffer(GL_COPY_WRITE_BUFFER))
+                return;
+        }
+        vector<unsigned char> data(size);
+        layout.writeVertices(vertices, count, quantization, &data[0]);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, offset, size, &data[0]);
+    }
+
+    // a buffer of `newSize` bytes holding the first `oldSize` bytes of `buffer`, which is deleted
+    static unsigned int resize(unsigned int buffer, size_t oldSize, size_t newSize)
+    {
+        unsigned int resized;
+        glGenBuffers(1, &resized);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, resized);
+        glBufferData(GL_COPY_WRITE_BUFFER, newSize, NULL, GL_STATIC_DRAW);
+        if (buffer)
+        {
+            glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, oldSize);
+            glDeleteBuffers(1, &buffer);
+        }
+        return resized;
+    }
+
+    void growVertices(size_t needed)
+    {
+        size_t oldCount = vertexRanges.size();
+        size_t newCount = std::max(std::max(oldCount * 2, oldCount + needed), ARENA_INITIAL_VERTICES);
+        if (layout.stride > 0)
+            VBO = resize(VBO, oldCount * layout.stride, newCount * layout.stride);
+        if (split)
+            positionVBO = resize(positionVBO, oldCount * positionLayout.stride, newCount * positionLayout.stride);
+        vertexRanges.grow(newCount);
+        bindBuffers();
+    }
+
+    void growIndices(size_t needed)
+    {
+        size_t oldSize = indexRanges.size();
+        size_t newSize = std::max(std::max(oldSize * 2, oldSize + needed + 4), ARENA_INITIAL_INDEX_BYTES);
+        EBO = resize(EBO, oldSize, newSize);
+        indexRanges.grow(newSize);
+        bindBuffers();
+    }
+
+    // points the vertex arrays at the current buffers
+    void bindBuffers()
+    {
+        GLState::instance().bindVertexArray(VAO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        if (split)
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
+            positionLayout.setAttributePointers();
+        }
+        if (layout.stride > 0)
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, VBO);
+            layout.setAttributePointers();
+        }
+        if (split)
+        {
+            GLState::instance().bindVertexArray(positionVAO);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+            glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
+            positionLayout.setAttributePointers();
+        }
+        GLState::instance().bindVertexArray(0);
+    }
+};
+
+// The scene's vertex arenas, one per vertex layout: every static mesh loaded shares the buffers of the other meshes
+// laid out like it, whichever model it belongs to.
+class BufferArenas
+{
+public:
+    static BufferArenas& instance()
+    {
+        static BufferArenas arenas;
+        return arenas;
+    }
+
+    VertexArena& arenaFor(unsigned int attributes, VertexFormat format, bool splitPositions)
+    {
+        unsigned int key = (attributes & ATTRIBUTES_ALL) | (format == VERTEX_PACKED ? 8 : 0) | (splitPositions ? 16 : 0);
+        VertexArena* &arena = arenas[key];
+        if (!arena)
+            arena = new VertexArena(attributes, format, splitPositions);
+        return *arena;
+    }
+
+    // number of arenas, i.e. of distinct vertex layouts in use
+    size_t size() const
+    {
+        return arenas.size();
+    }
+
+    // frees all arenas, call once no mesh is left
+    void clear()
+    {
+        for (map<unsigned int, VertexArena*>::iterator it = arenas.begin(); it != arenas.end(); ++it)
+        {
+            it->second->Delete();
+            delete it->second;
+        }
+        arenas.clear();
+    }
+
+private:
+    map<unsigned int, VertexArena*> arenas;
+
+    BufferArenas() {}
+};
+
+#endif /* buffer_arena_h */
@@ -0,0 +1,30 @@
+#version 330 core
+// position-only pass over the model meshes (Mesh::DrawPositions), transforms like model_loading.vs
+#ifdef PACKED_VERTEX
+layout (location = 0) in vec4 aPos; // unorm16, relative to the mesh bounds
+
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+
+vec3 position() { return positionOffset + aPos.xyz * positionScale; }
+#else
+layout (location = 0) in vec3 aPos;
+
+vec3 position() { return aPos; }
+#endif
+
+// same depth as the shading pass, which is drawn with GL_LEQUAL on top
+invariant gl_Position;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+uniform vec4 plane;
+
+
+void main()
+{
+    vec4 worldPos = model * vec4(position(), 1.0);
+    gl_ClipDistance[0] = dot(worldPos, plane);
+    gl_Position = projection * view * worldPos;
+}
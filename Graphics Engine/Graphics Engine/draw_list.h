@@ -0,0 +1,137 @@
+//
+//  draw_list.h
+//  Graphics Engine
+//
+//  Copyright © 2017 Tony. All rights reserved.
+//
+
+#ifndef draw_list_h
+#define draw_list_h
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "mesh.h"
+#include "render_queue.h"
+#include "scene.h"
+#include "shader.h"
+
+#include <cstdint>
+#include <vector>
+using namespace std;
+
+// One mesh draw of a frame, with everything about it that is the same in every pass.
+struct DrawItem {
+    const Mesh* mesh;
+    const vector<Texture>* overrides; // of the mesh's object
+    uint32_t object;                  // index of the object, draws of the same object share its matrix
+    unsigned int material;            // see Mesh::material
+    glm::mat4 world;
+    glm::vec3 center;                 // bounding sphere in world space
+    float radius;
+    float scale;                      // of `world`, see transformScale
+};
+
+constexpr UniformName UNIFORM_MODEL("model");
+
+// The model matrix the draws submitted so far left set. Call useShader after switching shaders.
+struct DrawState {
+    static const uint32_t NO_OBJECT = 0xffffffff;
+
+    const Shader* shader;      // in use
+    Uniform<glm::mat4> model;  // of `shader`
+    uint32_t object;           // whose matrix `model` holds
+
+    DrawState() : shader(NULL), object(NO_OBJECT) {}
+
+    void useShader(const Shader &shaderInUse)
+    {
+        shader = &shaderInUse;
+        model = shader->uniform<glm::mat4>(UNIFORM_MODEL);
+        object = NO_OBJECT;
+    }
+
+    // sets the "model" matrix unless the previous draw already did for the same object
+    void setModelMatrix(uint32_t drawObject, const glm::mat4 &matrix)
+    {
+        if (drawObject == object)
+            return;
+        shader->set(model, matrix);
+        object = drawObject;
+    }
+};
+
+// The mesh draws of a frame, recorded from the scene once and put into the render queue of every pass (reflection,
+// refraction, the main view), which only differ in the camera and clip plane they set up. Drawing an item doesn't
+// walk the scene or transform anything: its object's matrix is set once and its level of detail is picked from the
+// world-space bounds.
+class DrawList
+{
+public:
+    // records the scene's objects as they are now; the list points into the scene, record again after changing it
+    void record(const Scene &scene)
+    {
+        items.clear(); // keeps the capacity, recording every frame doesn't allocate
+        const vector<SceneObject> &objects = scene.allObjects();
+        for (uint32_t o = 0; o < objects.size(); o++)
+        {
+            const SceneObject &object = objects[o];
+            const Model &model = scene.model(object.model);
+            float scale = transformScale(object.transform);
+            for (size_t m = 0; m < model.meshes.size(); m++)
+            {
+                const Mesh &mesh = model.meshes[m];
+                DrawItem item;
+                item.mesh = &mesh;
+                item.overrides = &object.overrides;
+                item.object = o;
+                item.material = mesh.material(object.overrides);
+                item.world = object.transform;
+                item.center = glm::vec3(object.transform * glm::vec4(mesh.boundsCenter, 1.0f));
+                item.radius = mesh.boundsRadius * scale;
+                item.scale = scale;
+                items.push_back(item);
+            }
+        }
+    }
+
+    // submits every item to `queue` for a pass drawn with `shader` (a Scene shader handle) from `eye`; the commands'
+    // items are indices into the list. depth pass draws only read positions and ignore the material
+    void enqueue(RenderQueue &queue, RenderPass pass, ShaderId shader, const glm::vec3 &eye, float farPlane) const
+    {
+        bool positions = pass == RENDER_PASS_DEPTH;
+        for (size_t i = 0; i < items.size(); i++)
+        {
+            const DrawItem &item = items[i];
+            float depth = (glm::length(item.center - eye) - item.radius) / farPlane;
+            queue.submit(renderKey(pass, shader.index, positions ? 0 : item.material, positions ? item.mesh->positionVAO : item.mesh->VAO, depth), (uint32_t)i);
+        }
+    }
+
+    // draws an item with `shader`, at the level of detail `lod` picks. the shader must be in use and have the pass's
+    // view, projection and clip plane set
+    void draw(uint32_t index, const Shader &shader, const LodSelector &lod, DrawState &state) const
+    {
+        const DrawItem &item = items[index];
+        state.setModelMatrix(item.object, item.world);
+        item.mesh->Draw(shader, *item.overrides, lod.select(*item.mesh, item.center, item.radius, item.scale));
+    }
+
+    // the same for a shader that only reads positions, see Mesh::DrawPositions
+    void drawPositions(uint32_t index, const Shader &shader, const LodSelector &lod, DrawState &state) const
+    {
+        const DrawItem &item = items[index];
+        state.setModelMatrix(item.object, item.world);
+        item.mesh->DrawPositions(shader, lod.select(*item.mesh, item.center, item.radius, item.scale));
+    }
+
+    size_t size() const
+    {
+        return items.size();
+    }
+
+private:
+    vector<DrawItem> items;
+};
+
+#endif /* draw_list_h */
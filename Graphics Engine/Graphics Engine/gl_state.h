@@ -0,0 +1,204 @@
+//
+//  gl_state.h
+//  Graphics Engine
+//
+//  Copyright © 2017 Tony. All rights reserved.
+//
+
+#ifndef gl_state_h
+#define gl_state_h
+
+#include <glad/glad.h>
+
+#include <cstddef>
+
+// texture units the cache tracks, units above it are bound straight through
+const int GL_STATE_TEXTURE_UNITS = 16;
+
+// unit texture uploads bind their texture to (see selectTexture), away from the units draws sample
+const int TEXTURE_UPLOAD_UNIT = GL_STATE_TEXTURE_UNITS - 1;
+
+// Shadow copy of the GL state the render loop sets: program, vertex array, textures per unit, framebuffer, and the
+// blend, depth test, face culling and clip distance switches plus the depth function and color mask. A call that
+// sets what is already set doesn't reach the driver. Texture uploads, vertex arenas and deletes of textures and
+// vertex arrays go through it as well, so the cache stays right across loads; only setup code that binds through GL
+// directly has to call invalidate() before the cache is used again, which the render loop does once before it starts.
+class GLState
+{
+public:
+    // state calls of the current frame that reached the driver and that were dropped as redundant
+    struct Counters {
+        unsigned int issued;
+        unsigned int filtered;
+    };
+
+    static GLState& instance()
+    {
+        static GLState state;
+        return state;
+    }
+
+    void useProgram(unsigned int program)
+    {
+        if (changed(currentProgram, program))
+            glUseProgram(program);
+    }
+
+    void bindVertexArray(unsigned int vertexArray)
+    {
+        if (changed(currentVertexArray, vertexArray))
+            glBindVertexArray(vertexArray);
+    }
+
+    // binds a GL_TEXTURE_2D or GL_TEXTURE_2D_ARRAY texture to a unit, making the unit active only if it's a change
+    void bindTexture(int unit, GLenum target, unsigned int texture)
+    {
+        if (unit >= GL_STATE_TEXTURE_UNITS)
+        {
+            activeTexture(unit);
+            glBindTexture(target, texture);
+            counters.issued++;
+            return;
+        }
+        unsigned int &bound = target == GL_TEXTURE_2D_ARRAY ? textureArrays[unit] : textures[unit];
+        if (!changed(bound, texture))
+            return;
+        activeTexture(unit);
+        glBindTexture(target, texture);
+    }
+
+    // binds a texture to a unit and makes that unit active, for calls that act on the active unit's texture
+    // (uploads, parameters)
+    void selectTexture(int unit, GLenum target, unsigned int texture)
+    {
+        activeTexture(unit);
+        bindTexture(unit, target, texture);
+    }
+
+    // deletes a texture, which GL unbinds from every unit it is bound to
+    void deleteTexture(unsigned int texture)
+    {
+        for (int i = 0; i < GL_STATE_TEXTURE_UNITS; i++)
+        {
+            if (textures[i] == texture)
+                textures[i] = 0;
+            if (textureArrays[i] == texture)
+                textureArrays[i] = 0;
+        }
+        glDeleteTextures(1, &texture);
+    }
+
+    // deletes a vertex array, which GL unbinds if it is bound
+    void deleteVertexArray(unsigned int vertexArray)
+    {
+        if (currentVertexArray == vertexArray)
+            currentVertexArray = 0;
+        glDeleteVertexArrays(1, &vertexArray);
+    }
+
+    void bindFramebuffer(unsigned int framebuffer)
+    {
+        if (changed(currentFramebuffer, framebuffer))
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    }
+
+    // GL_BLEND, GL_DEPTH_TEST, GL_CULL_FACE or GL_CLIP_DISTANCE0
+    void setEnabled(GLenum capability, bool enabled)
+    {
+        unsigned int* current = capabilityState(capability);
+        if (!current)
+            counters.issued++;
+        else if (!changed(*current, enabled ? 1u : 0u))
+            return;
+        if (enabled)
+            glEnable(capability);
+        else
+            glDisable(capability);
+    }
+
+    void depthFunc(GLenum function)
+    {
+        if (changed(currentDepthFunc, function))
+            glDepthFunc(function);
+    }
+
+    void colorMask(bool red, bool green, bool blue, bool alpha)
+    {
+        unsigned int mask = (red ? 1 : 0) | (green ? 2 : 0) | (blue ? 4 : 0) | (alpha ? 8 : 0);
+        if (changed(currentColorMask, mask))
+            glColorMask(red, green, blue, alpha);
+    }
+
+    // forgets everything, the next call of each kind reaches the driver
+    void invalidate()
+    {
+        currentProgram = currentVertexArray = currentFramebuffer = UNKNOWN;
+        activeUnit = UNKNOWN;
+        for (int i = 0; i < GL_STATE_TEXTURE_UNITS; i++)
+            textures[i] = textureArrays[i] = UNKNOWN;
+        blend = depthTest = cullFace = clipDistance0 = UNKNOWN;
+        currentDepthFunc = currentColorMask = UNKNOWN;
+    }
+
+    const Counters& frameCounters() const
+    {
+        return counters;
+    }
+
+    // starts counting the next frame
+    void endFrame()
+    {
+        counters.issued = 0;
+        counters.filtered = 0;
+    }
+
+private:
+    static const unsigned int UNKNOWN = 0xffffffff;
+
+    unsigned int currentProgram, currentVertexArray, currentFramebuffer;
+    unsigned int activeUnit;
+    unsigned int textures[GL_STATE_TEXTURE_UNITS];      // GL_TEXTURE_2D
+    unsigned int textureArrays[GL_STATE_TEXTURE_UNITS]; // GL_TEXTURE_2D_ARRAY
+    unsigned int blend, depthTest, cullFace, clipDistance0;
+    unsigned int currentDepthFunc, currentColorMask;
+    Counters counters;
+
+    GLState()
+    {
+        invalidate();
+        endFrame();
+    }
+
+    // records `value` and counts the call, false if it was already set
+    bool changed(unsigned int &current, unsigned int value)
+    {
+        if (current == value)
+        {
+            counters.filtered++;
+            return false;
+        }
+        current = value;
+        counters.issued++;
+        return true;
+    }
+
+    void activeTexture(int unit)
+    {
+        if (changed(activeUnit, (unsigned int)unit))
+            glActiveTexture(GL_TEXTURE0 + unit);
+    }
+
+    unsigned int* capabilityState(GLenum capability)
+    {
+        switch (capability)
+        {
+            case GL_BLEND: return &blend;
+            case GL_DEPTH_TEST: return &depthTest;
+            case GL_CULL_FACE: return &cullFace;
+            case GL_CLIP_DISTANCE0: return &clipDistance0;
+            default: return NULL;
+        }
+    }
+};
+
+#endif /* gl_state_h */
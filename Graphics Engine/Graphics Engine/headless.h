@@ -0,0 +1,209 @@
+//
+//  headless.h
+//  Graphics Engine
+//
+//  Copyright © 2017 Tony. All rights reserved.
+//
+
+#ifndef headless_h
+#define headless_h
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#if defined(__linux__)
+#include <EGL/egl.h>
+#endif
+
+#include <iostream>
+
+// An OpenGL 3.3 core context that has no visible window. On Linux this is a surfaceless EGL context
+// (works on build boxes without a display, e.g. Mesa llvmpipe); elsewhere it falls back to a hidden GLFW window.
+// Since there is no default framebuffer to draw into, the context owns an offscreen framebuffer of the requested size
+// that stands in for it.
+class HeadlessContext
+{
+public:
+    // offscreen framebuffer that replaces the default framebuffer
+    unsigned int FBO;
+
+    HeadlessContext() : FBO(0), colorBuffer(0), depthBuffer(0), window(NULL)
+#if defined(__linux__)
+    , display(EGL_NO_DISPLAY), context(EGL_NO_CONTEXT), surface(EGL_NO_SURFACE)
+#endif
+    {
+    }
+
+    // creates the context, makes it current and loads all OpenGL function pointers
+    bool create(unsigned int width, unsigned int height)
+    {
+#if defined(__linux__)
+        if (!createEGL())
+            return false;
+        if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress))
+        {
+            std::cout << "Failed to initialize GLAD" << std::endl;
+            return false;
+        }
+#else
+        if (!createGLFW())
+            return false;
+        if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+        {
+            std::cout << "Failed to initialize GLAD" << std::endl;
+            return false;
+        }
+#endif
+        createFramebuffer(width, height);
+        // a surfaceless context starts out with an empty viewport
+        glViewport(0, 0, width, height);
+        return true;
+    }
+
+    // makes sure all submitted work has been handed to the GPU (there is no swap to do this for us)
+    void present()
+    {
+        glFlush();
+    }
+
+    void destroy()
+    {
+        if (FBO)
+        {
+            glDeleteFramebuffers(1, &FBO);
+            glDeleteTextures(1, &colorBuffer);
+            glDeleteRenderbuffers(1, &depthBuffer);
+            FBO = 0;
+        }
+#if defined(__linux__)
+        if (display != EGL_NO_DISPLAY)
+        {
+            eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            if (surface != EGL_NO_SURFACE)
+                eglDestroySurface(display, surface);
+            if (context != EGL_NO_CONTEXT)
+                eglDestroyContext(display, context);
+            eglTerminate(display);
+            display = EGL_NO_DISPLAY;
+        }
+#else
+        if (window)
+        {
+            glfwDestroyWindow(window);
+            glfwTerminate();
+            window = NULL;
+        }
+#endif
+    }
+
+private:
+    unsigned int colorBuffer, depthBuffer;
+    GLFWwindow* window;
+#if defined(__linux__)
+    EGLDisplay display;
+    EGLContext context;
+    EGLSurface surface;
+
+    bool createEGL()
+    {
+        // prefer Mesa's surfaceless platform so no X server or GPU device is required
+        typedef EGLDisplay (*GetPlatformDisplayProc)(EGLenum, void*, const EGLint*);
+        const EGLenum EGL_PLATFORM_SURFACELESS = 0x31DD; // EGL_PLATFORM_SURFACELESS_MESA
+        GetPlatformDisplayProc getPlatformDisplay = (GetPlatformDisplayProc)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (getPlatformDisplay)
+            display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS, EGL_DEFAULT_DISPLAY, NULL);
+        if (display == EGL_NO_DISPLAY)
+            display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL))
+        {
+            std::cout << "Failed to initialize EGL display" << std::endl;
+            return false;
+        }
+
+        const EGLint configAttribs[] = {
+            EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_NONE
+        };
+        EGLConfig config;
+        EGLint numConfigs = 0;
+        if (!eglChooseConfig(display, configAttribs, &config, 1, &numConfigs) || numConfigs == 0)
+        {
+            std::cout << "Failed to choose EGL config" << std::endl;
+            return false;
+        }
+
+        eglBindAPI(EGL_OPENGL_API);
+        const EGLint contextAttribs[] = {
+            0x3098, 3, // EGL_CONTEXT_MAJOR_VERSION
+            0x30FB, 3, // EGL_CONTEXT_MINOR_VERSION
+            0x30FD, 0x00000001, // EGL_CONTEXT_OPENGL_PROFILE_MASK: core profile
+            EGL_NONE
+        };
+        context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+        if (context == EGL_NO_CONTEXT)
+        {
+            std::cout << "Failed to create EGL context" << std::endl;
+            return false;
+        }
+
+        // without EGL_KHR_surfaceless_context we need a dummy pbuffer to make the context current
+        if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+        {
+            const EGLint pbufferAttribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+            surface = eglCreatePbufferSurface(display, config, pbufferAttribs);
+            if (surface == EGL_NO_SURFACE || !eglMakeCurrent(display, surface, surface, context))
+            {
+                std::cout << "Failed to make EGL context current" << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+#else
+    bool createGLFW()
+    {
+        glfwInit();
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+#ifdef __APPLE__
+        glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        window = glfwCreateWindow(1, 1, "Graphics Engine", NULL, NULL);
+        if (window == NULL)
+        {
+            std::cout << "Failed to create hidden GLFW window" << std::endl;
+            glfwTerminate();
+            return false;
+        }
+        glfwMakeContextCurrent(window);
+        glfwSwapInterval(0); // vsync off, we never swap anyway
+        return true;
+    }
+#endif
+
+    void createFramebuffer(unsigned int width, unsigned int height)
+    {
+        glGenFramebuffers(1, &FBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        // create a color attachment texture
+        glGenTextures(1, &colorBuffer);
+        glBindTexture(GL_TEXTURE_2D, colorBuffer);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorBuffer, 0);
+        // create a depth render buffer attachment
+        glGenRenderbuffers(1, &depthBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::FRAMEBUFFER:: Headless framebuffer is not complete!" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+};
+
+#endif /* headless_h */
@@ -0,0 +1,83 @@
+//
+//  load_stats.h
+//  Graphics Engine
+//
+//  Copyright © 2017 Tony. All rights reserved.
+//
+
+#ifndef load_stats_h
+#define load_stats_h
+
+#include <chrono>
+#include <cstddef>
+
+// Effect of the load-time mesh optimization (see optimizeMesh), summed over meshes.
+// ACMR is the average number of post-transform cache misses per triangle, 0.5 at best and 3 for unindexed meshes.
+struct MeshOptimizeStats {
+    size_t triangles;
+    size_t verticesBefore, verticesAfter;
+    size_t missesBefore, missesAfter;
+
+    MeshOptimizeStats() : triangles(0), verticesBefore(0), verticesAfter(0), missesBefore(0), missesAfter(0) {}
+
+    void add(const MeshOptimizeStats &other)
+    {
+        triangles += other.triangles;
+        verticesBefore += other.verticesBefore;
+        verticesAfter += other.verticesAfter;
+        missesBefore += other.missesBefore;
+        missesAfter += other.missesAfter;
+    }
+
+    double acmrBefore() const { return triangles ? (double)missesBefore / triangles : 0.0; }
+    double acmrAfter() const { return triangles ? (double)missesAfter / triangles : 0.0; }
+};
+
+// Time spent in each stage of model loading, accumulated over all loads since the last reset.
+struct ModelLoadStats {
+    double importMs;  // Assimp::Importer::ReadFile
+    double convertMs; // aiMesh -> Vertex/index conversion and mesh optimization
+    double decodeMs;  // image decoding and block compression, or reading the texture cache
+    double uploadMs;  // buffer and texture uploads
+    MeshOptimizeStats optimize; // of the meshes that were not read from the mesh cache
+
+    ModelLoadStats() { reset(); }
+
+    void reset()
+    {
+        importMs = convertMs = decodeMs = uploadMs = 0.0;
+        optimize = MeshOptimizeStats();
+    }
+};
+
+ModelLoadStats& modelLoadStats()
+{
+    static ModelLoadStats stats;
+    return stats;
+}
+
+// When set, model and texture loads ignore the mesh and texture caches and rebuild them as on a first load, so the
+// benchmark can time cold loads. Only change it while no texture is loading.
+bool& ignoreLoadCaches()
+{
+    static bool ignore = false;
+    return ignore;
+}
+
+// Adds the time between its construction and destruction to a ModelLoadStats field.
+class LoadTimer
+{
+public:
+    LoadTimer(double &target) : target(target), start(std::chrono::high_resolution_clock::now()) {}
+
+    ~LoadTimer()
+    {
+        target += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+private:
+    double &target;
+    std::chrono::high_resolution_clock::time_point start;
+};
+
+#endif /* load_stats_h */
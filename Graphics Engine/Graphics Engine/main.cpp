@@ -7,6 +7,15 @@
 #include "shader.h"
 #include "stb_image.h"
 #include "model.h"
+#include "model_registry.h"
+#include "scene.h"
+#include "draw_list.h"
+#include "render_queue.h"
+#include "gl_state.h"
+#include "headless.h"
+#include "benchmark.h"
+#include "profiler.h"
+#include "allocation_counter.h"
 
 // include glm
 #include <glm/glm.hpp>
@@ -21,7 +30,7 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void processInput(GLFWwindow *window);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
-void renderScene(Shader wallShader, Shader modelShader, Model zenigame, Model teemo, Model duck, float clipPlane[4]);
+void renderScene(const Scene &scene, const DrawList &drawList, ShaderId wallShader, ShaderId modelShader, ShaderId depthShader, float clipPlane[4], float lodBias);
 unsigned int initializeReflectionFBO();
 unsigned int initializeRefractionFBO();
 
@@ -38,6 +47,7 @@ bool firstMouse = true;
 // timing
 float deltaTime = 0.0f;    // time between current frame and last frame
 float lastFrame = 0.0f;
+float sceneTime = 0.0f;    // time used to animate the scene, fixed steps in benchmark mode
 
 // Global var for convenience
 unsigned int reflectionColorBuffer;
@@ -50,6 +60,8 @@ float plane[4] = { 0, -1, 0, 100000 };
 unsigned int wallVAO, floorVAO;
 unsigned int texture1, texture2;
 
+unsigned int screenFBO = 0; // framebuffer the final image goes to, offscreen in benchmark mode
+
 unsigned int DuDvTexture;
 
 unsigned int normalTexture;
@@ -57,43 +69,83 @@ unsigned int normalTexture;
 float wave_speed = 0.03f;
 float moveFactor = 0;
 
+// level of detail: the screen-space error a model mesh may show, in pixels (--lod-error), and how much more the
+// reflection and refraction passes accept, the water distorts them anyway
+float lodErrorPixels = 1.0f;
+const float WATER_PASS_LOD_BIAS = 4.0f;
+
+// the same for every pass
+const float FAR_PLANE = 100.0f;
+const glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, FAR_PLANE);
+
+// uniforms every pass sets, hashed at compile time (see UniformName)
+constexpr UniformName UNIFORM_PROJECTION("projection");
+constexpr UniformName UNIFORM_VIEW("view");
+constexpr UniformName UNIFORM_PLANE("plane");
+
+// the walls and the floor, drawn with the wall shader through the render queue alongside the model meshes. their
+// queue items are SCENE_GEOMETRY_ITEM | index, the draw list's items are plain indices
+struct SceneGeometry {
+    unsigned int vertexArray;
+    unsigned int texture;
+    int vertexCount;
+    glm::vec3 center;
+};
+const uint32_t SCENE_GEOMETRY_ITEM = 0x80000000;
+const uint32_t SCENE_GEOMETRY_OBJECT = 0xfffffffe; // stands for the geometry's identity "model" matrix in DrawState
+vector<SceneGeometry> sceneGeometry;
+RenderQueue renderQueue; // sorted again for each pass, see renderScene
+
 // lighting
 glm::vec3 lightPos(0, 3, 0);
 glm::vec3 light_Color(1, 1, 1);
 
-int main()
+int main(int argc, char** argv)
 {
+    BenchmarkOptions benchmark = parseBenchmarkOptions(argc, argv);
     
     // --------------- set glfw, glad ------------------
     
-    // glfw: initialize and configure
-    glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    
-#ifdef __APPLE__
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-#endif
-    
-    // glfw window creation
-    GLFWwindow* window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "Graphics Engine", NULL, NULL);
-    if (window == NULL)
+    GLFWwindow* window = NULL;
+    HeadlessContext headless;
+    if (benchmark.enabled)
     {
-        std::cout << "Failed to create GLFW window" << std::endl;
-        glfwTerminate();
-        return -1;
+        // render offscreen without a window and with vsync off
+        if (!headless.create(SCR_WIDTH, SCR_HEIGHT))
+            return -1;
+        screenFBO = headless.FBO;
     }
-    glfwMakeContextCurrent(window);
-    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
-    glfwSetCursorPosCallback(window, mouse_callback); // set mouse callback
-    glfwSetScrollCallback(window, scroll_callback); // set scroll callback
-    
-    // glad: load all OpenGL function pointers
-    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+    else
     {
-        std::cout << "Failed to initialize GLAD" << std::endl;
-        return -1;
+        // glfw: initialize and configure
+        glfwInit();
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        
+#ifdef __APPLE__
+        glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+        
+        // glfw window creation
+        window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "Graphics Engine", NULL, NULL);
+        if (window == NULL)
+        {
+            std::cout << "Failed to create GLFW window" << std::endl;
+            glfwTerminate();
+            return -1;
+        }
+        glfwMakeContextCurrent(window);
+        glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+        glfwSetCursorPosCallback(window, mouse_callback); // set mouse callback
+        glfwSetScrollCallback(window, scroll_callback); // set scroll callback
+        
+        // glad: load all OpenGL function pointers
+        if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+        {
+            std::cout << "Failed to initialize GLAD" << std::endl;
+            return -1;
+        }
     }
     
     // ------- configure global opengl state -------
@@ -109,15 +161,51 @@ int main()
     
     Shader screenShader("./screenShader.vs", "./screenShader.frag");
     
-    Shader modelShader("./model_loading.vs", "./model_loading.frag");
+    Shader modelShader("./model_loading.vs", "./model_loading.frag", benchmark.packedVertices ? "#define PACKED_VERTEX\n" : NULL);
+    
+    // model depth pre-pass, reads the position streams only
+    Shader depthShader("./depth.vs", "./depth.frag", benchmark.packedVertices ? "#define PACKED_VERTEX\n" : NULL);
+    
+    // the passes refer to shaders, models and objects by handle (see Scene)
+    Scene scene;
+    ShaderId wallShaderId = scene.addShader(wallShader);
+    ShaderId modelShaderId = scene.addShader(modelShader);
+    ShaderId depthPrepass = benchmark.depthPrepass ? scene.addShader(depthShader) : ShaderId();
     
     // ----------------- load models ----------------
     
-    Model zenigame(string("../models/teemo/zenigame.obj"));
+    meshVertexFormat() = benchmark.packedVertices ? VERTEX_PACKED : VERTEX_FULL;
+    meshPositionStreams() = benchmark.depthPrepass;
+    lodErrorPixels = benchmark.lodErrorPixels;
+    // the meshes only store the vertex attributes the model shader reads
+    unsigned int modelAttributes = shaderVertexAttributes(modelShader.ID);
+    
+    // each model file is loaded once (see ModelRegistry), every placement of it is an object with its own transform
+    glm::mat4 transform;
     
-    Model teemo(string("../models/teemo/teemo.obj"));
+    // zenigame
+    transform = glm::mat4(1.0f); // load identity matrix
+    transform = glm::translate(transform, glm::vec3(0.4f, -1.0f, -2.5f));
+    transform = glm::scale(transform, glm::vec3(0.2f, 0.2f, 0.2f));    // it's a bit too big for our scene, so scale it down
+    scene.addObject(scene.addModel(ModelRegistry::instance().acquire("../models/teemo/zenigame.obj", false, modelAttributes)), transform);
+    
+    // teemo
+    transform = glm::mat4(1.0f); // load identity matrix
+    transform = glm::translate(transform, glm::vec3(0.0f, 0.2f, 0.2f));
+    transform = glm::scale(transform, glm::vec3(0.005f, 0.005f, 0.005f));    // it's a bit too big for our scene, so scale it down
+    scene.addObject(scene.addModel(ModelRegistry::instance().acquire("../models/teemo/teemo.obj", false, modelAttributes)), transform);
+    
+    // duck, its transform is animated in the render loop
+    ObjectId duck = scene.addObject(scene.addModel(ModelRegistry::instance().acquire("../models/teemo/duck.obj", false, modelAttributes)));
+    
+    // recorded from the scene every frame, then drawn by each pass
+    DrawList drawList;
     
-    Model duck(string("../models/teemo/duck.obj"));
+    // meshes read from the mesh cache were optimized when the cache was written
+    const MeshOptimizeStats &optimized = modelLoadStats().optimize;
+    if (optimized.triangles > 0)
+        std::cout << "Mesh optimization: " << optimized.verticesBefore << " -> " << optimized.verticesAfter << " vertices, ACMR "
+                  << optimized.acmrBefore() << " -> " << optimized.acmrAfter() << " over " << optimized.triangles << " triangles" << std::endl;
     
     // ----------------- data processing ----------------
     
@@ -251,99 +339,34 @@ int main()
     
     // -------------- textures ---------------------
     
-    // texture 1
-    glGenTextures(1, &texture1);
-    glBindTexture(GL_TEXTURE_2D, texture1);
-    // set the texture wrapping parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);	// set texture wrapping to GL_REPEAT (default wrapping method)
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    // set texture filtering parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    // load image, create texture and generate mipmaps
-    int width, height, nrChannels;
-    stbi_set_flip_vertically_on_load(true); // tell stb_image.h to flip loaded texture's on the y-axis.
-    unsigned char *data = stbi_load("../textures/marble.bmp", &width, &height, &nrChannels, 0);
-    if (data)
-    {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-    }
-    else
-    {
-        std::cout << "Failed to load texture1" << std::endl;
-    }
-    stbi_image_free(data);
-    
-    // texture 2
-    glGenTextures(1, &texture2);
-    glBindTexture(GL_TEXTURE_2D, texture2);
-    // set the texture wrapping parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);    // set texture wrapping to GL_REPEAT (default wrapping method)
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    // set texture filtering parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    // load image, create texture and generate mipmaps
-    stbi_set_flip_vertically_on_load(true); // tell stb_image.h to flip loaded texture's on the y-axis.
-    data = stbi_load("../textures/bamboo.jpg", &width, &height, &nrChannels, 0);
-    if (data)
-    {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-    }
-    else
-    {
-        std::cout << "Failed to load texture2" << std::endl;
-    }
-    stbi_image_free(data);
-    
-    // load DuDv texture
-    glGenTextures(1, &DuDvTexture);
-    glBindTexture(GL_TEXTURE_2D, DuDvTexture);
-    // set the texture wrapping parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);    // set texture wrapping to GL_REPEAT (default wrapping method)
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    // set texture filtering parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    // load image, create texture and generate mipmaps
-    stbi_set_flip_vertically_on_load(true); // tell stb_image.h to flip loaded texture's on the y-axis.
-    data = stbi_load("../textures/waterDUDV.png", &width, &height, &nrChannels, 0);
-    if (data)
-    {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-    }
-    else
-    {
-        std::cout << "Failed to load DuDv texture" << std::endl;
-    }
-    stbi_image_free(data);
-    
-    // load normal texture
-    glGenTextures(1, &normalTexture);
-    glBindTexture(GL_TEXTURE_2D, normalTexture);
-    // set the texture wrapping parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);    // set texture wrapping to GL_REPEAT (default wrapping method)
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    // set texture filtering parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    // load image, create texture and generate mipmaps
-    stbi_set_flip_vertically_on_load(true); // tell stb_image.h to flip loaded texture's on the y-axis.
-    data = stbi_load("../textures/normalMap.png", &width, &height, &nrChannels, 0);
-    // data = stbi_load("../textures/matchingNormalMap.png", &width, &height, &nrChannels, 0);
-    if (data)
-    {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-    }
-    else
-    {
-        std::cout << "Failed to load normal texture" << std::endl;
-    }
-    stbi_image_free(data);
+    // textures are decoded on worker threads and stream in over the next frames (see TextureLoader)
+    TextureLoader::instance().setUploadBudget((size_t)(benchmark.uploadBudgetMB * 1024 * 1024));
+    TextureLoader::instance().setCompressionEnabled(!benchmark.rawTextures);
+    TextureOptions textureOptions;
+    textureOptions.wrap = GL_REPEAT; // set texture wrapping to GL_REPEAT (default wrapping method)
+    textureOptions.minFilter = GL_LINEAR;
+    textureOptions.magFilter = GL_LINEAR;
+    textureOptions.flipVertically = true; // flip loaded texture's on the y-axis.
+    
+    texture1 = TextureRegistry::instance().acquire("../textures/marble.bmp", textureOptions);
+    texture2 = TextureRegistry::instance().acquire("../textures/bamboo.jpg", textureOptions);
+    // the water shader reads two channels of the normal and DuDv maps, which hold vectors rather than colors
+    textureOptions.compression = TEXTURE_COMPRESS_TWO_CHANNEL;
+    textureOptions.srgb = false;
+    normalTexture = TextureRegistry::instance().acquire("../textures/normalMap.png", textureOptions);
+    // normalTexture = TextureRegistry::instance().acquire("../textures/matchingNormalMap.png", textureOptions);
+    // the DuDv map is sampled with mipmaps
+    textureOptions.minFilter = GL_LINEAR_MIPMAP_LINEAR;
+    DuDvTexture = TextureRegistry::instance().acquire("../textures/waterDUDV.png", textureOptions);
+    
+    SceneGeometry walls = { wallVAO, texture1, 24, glm::vec3(0.0f) };  // marble texture
+    SceneGeometry ground = { floorVAO, texture2, 6, glm::vec3(0.0f, -2.0f, 0.0f) }; // floor texture
+    sceneGeometry.push_back(walls);
+    sceneGeometry.push_back(ground);
+    
+    // benchmark frames must not include texture uploads
+    if (benchmark.enabled)
+        TextureLoader::instance().finish();
 
     
     // ------------ shader configuration ---------------
@@ -353,6 +376,20 @@ int main()
     
     screenShader.use();
     screenShader.setInt("screenTexture", 0);
+    
+    waterShader.use();
+    waterShader.setInt("reflectionTexture", 0);
+    waterShader.setInt("refractionTexture", 1);
+    waterShader.setInt("dudvMap", 2);
+    waterShader.setInt("normalMap", 3);
+    // the water's per-frame uniforms, resolved once
+    Uniform<glm::vec3> waterCameraPosition = waterShader.uniform<glm::vec3>("cameraPosition");
+    Uniform<glm::vec3> waterLightPosition = waterShader.uniform<glm::vec3>("lightPosition");
+    Uniform<glm::vec3> waterLightColor = waterShader.uniform<glm::vec3>("lightColor");
+    Uniform<float> waterMoveFactor = waterShader.uniform<float>("moveFactor");
+    Uniform<glm::mat4> waterProjection = waterShader.uniform<glm::mat4>(UNIFORM_PROJECTION);
+    Uniform<glm::mat4> waterView = waterShader.uniform<glm::mat4>(UNIFORM_VIEW);
+    Uniform<glm::mat4> waterModel = waterShader.uniform<glm::mat4>("model");
 
     // ----------- frame buffer configuration ----------
     
@@ -365,85 +402,107 @@ int main()
     // glPolygonMode(GL_FRONT_AND_BACK, GL_LINE); // uncomment to see that we only rendered a single quad in screen space using FBOs
     
     // --------------- render loop ------------------------
-    while (!glfwWindowShouldClose(window))
+    Profiler::instance().enabled = !benchmark.tracePath.empty();
+    FrameBenchmark* frameBenchmark = benchmark.enabled ? new FrameBenchmark(benchmark.warmupFrames, benchmark.frames, AllocationCounter::count) : NULL;
+    int frame = 0;
+    // the setup above binds framebuffers, textures and vertex arrays without GLState
+    GLState::instance().invalidate();
+    while (benchmark.enabled ? frame < benchmark.warmupFrames + benchmark.frames : !glfwWindowShouldClose(window))
     {
-        glEnable(GL_CLIP_DISTANCE0); // enable clip distance
+        PROFILE_SCOPE("frame");
+        if (frameBenchmark)
+            frameBenchmark->beginFrame(TextureLoader::instance().pending() == 0);
+        
+        GLState::instance().setEnabled(GL_CLIP_DISTANCE0, true); // enable clip distance
         
         // timing
-        float currentFrame = glfwGetTime();
+        float currentFrame = benchmark.enabled ? frame / 60.0f : glfwGetTime(); // fixed time step keeps benchmark runs repeatable
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
+        sceneTime = currentFrame;
+        
+        // spin the duck
+        glm::mat4 duckTransform = glm::mat4(1.0f); // load identity matrix
+        duckTransform = glm::translate(duckTransform, glm::vec3(-0.3f, 0.1f, 3.0f));
+        duckTransform = glm::scale(duckTransform, glm::vec3(0.0002f, 0.0002f, 0.0002f));    // it's a bit too big for our scene, so scale it down
+        duckTransform = glm::rotate(duckTransform, sceneTime, glm::vec3(0.0f, 1.0f, 0.0f));
+        scene.object(duck).transform = duckTransform;
+        
+        // the model draws of all passes
+        drawList.record(scene);
         
         // input
-        processInput(window);
+        if (window)
+            processInput(window);
+        
+        // upload textures that finished decoding
+        TextureLoader::instance().update();
         
         // ------------------ 1st pass ---------------
         
-        glEnable(GL_DEPTH_TEST); // enable depth testing (is disabled for rendering screen-space quad)
+        GLState::instance().setEnabled(GL_DEPTH_TEST, true); // enable depth testing (is disabled for rendering screen-space quad)
         
-        // render reflection texture
-        glBindFramebuffer(GL_FRAMEBUFFER, reflectionFBO);
-        float distance = 2 * ( camera.Position.y - 0 );
-        camera.Position.y -= distance;
-        camera.invertPitch(); // invert camera pitch
-        renderScene(wallShader, modelShader, zenigame, teemo, duck, reflect_plane);
-        // reset camera back to original position
-        camera.Position.y += distance;
-        camera.invertPitch(); // invert back camera pitch
+        {
+            PROFILE_GPU_SCOPE("reflection");
+            // render reflection texture
+            GLState::instance().bindFramebuffer(reflectionFBO);
+            float distance = 2 * ( camera.Position.y - 0 );
+            camera.Position.y -= distance;
+            camera.invertPitch(); // invert camera pitch
+            renderScene(scene, drawList, wallShaderId, modelShaderId, depthPrepass, reflect_plane, WATER_PASS_LOD_BIAS);
+            // reset camera back to original position
+            camera.Position.y += distance;
+            camera.invertPitch(); // invert back camera pitch
+        }
         
-        // render refraction texture
-        glBindFramebuffer(GL_FRAMEBUFFER, refractionFBO);
-        renderScene(wallShader, modelShader, zenigame, teemo, duck, refract_plane);
+        {
+            PROFILE_GPU_SCOPE("refraction");
+            // render refraction texture
+            GLState::instance().bindFramebuffer(refractionFBO);
+            renderScene(scene, drawList, wallShaderId, modelShaderId, depthPrepass, refract_plane, WATER_PASS_LOD_BIAS);
+        }
 
         
         // render to screen
-        glDisable(GL_CLIP_DISTANCE0);
-        glBindFramebuffer(GL_FRAMEBUFFER, 0); // now bind back to default framebuffer
-        renderScene(wallShader, modelShader, zenigame, teemo, duck, plane);
-        // render water
-        waterShader.use();
-        waterShader.setInt("reflectionTexture", 0);
-        waterShader.setInt("refractionTexture", 1);
-        waterShader.setInt("dudvMap", 2);
-        waterShader.setInt("normalMap", 3);
+        GLState::instance().setEnabled(GL_CLIP_DISTANCE0, false);
+        {
+            PROFILE_GPU_SCOPE("scene");
+            GLState::instance().bindFramebuffer(screenFBO); // now bind back to default framebuffer
+            renderScene(scene, drawList, wallShaderId, modelShaderId, depthPrepass, plane, 1.0f);
+        }
+        {
+            PROFILE_GPU_SCOPE("water");
+            // render water
+            waterShader.use();
         
-        // pass camera position
-        glm::vec3 cameraPos = camera.Position;
-        GLuint cameraPosition_loc = glGetUniformLocation(waterShader.ID, "cameraPosition");
-        glUniform3fv(cameraPosition_loc, 1, glm::value_ptr(cameraPos));
-        // pass light position
-        GLuint lightPosition_loc = glGetUniformLocation(waterShader.ID, "lightPosition");
-        glUniform3fv(lightPosition_loc, 1, glm::value_ptr(lightPos));
-        // pass light color
-        GLuint lightColor_loc = glGetUniformLocation(waterShader.ID, "lightColor");
-        glUniform3fv(lightColor_loc, 1, glm::value_ptr(light_Color));
+            // pass camera position
+            waterShader.set(waterCameraPosition, camera.Position);
+            // pass light position
+            waterShader.set(waterLightPosition, lightPos);
+            // pass light color
+            waterShader.set(waterLightColor, light_Color);
         
-        // wave
-        moveFactor += wave_speed * currentFrame * 0.001; 
-        if (moveFactor >= 1)
-            moveFactor -= 1;
-        waterShader.setFloat("moveFactor", moveFactor);
+            // wave
+            moveFactor += wave_speed * currentFrame * 0.001; 
+            if (moveFactor >= 1)
+                moveFactor -= 1;
+            waterShader.set(waterMoveFactor, moveFactor);
         
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, reflectionColorBuffer);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, refractionColorBuffer);
-        glActiveTexture(GL_TEXTURE2);
-        glBindTexture(GL_TEXTURE_2D, DuDvTexture);
-        glActiveTexture(GL_TEXTURE3);
-        glBindTexture(GL_TEXTURE_2D, normalTexture);
-        glBindVertexArray(waterVAO);
-        // do transformations
-        glm::mat4 projection;
-        projection = glm::perspective(glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-        waterShader.setMat4("projection", projection);
-        // camera/view transformation
-        glm::mat4 view = camera.GetViewMatrix();
-        waterShader.setMat4("view", view);
-        glm::mat4 model= glm::mat4(1.0f);
-        model = glm::scale(model, glm::vec3(2.0, 1.0, 5.0));
-        waterShader.setMat4("model", model);
-        glDrawArrays(GL_TRIANGLES, 0, 6);
+            GLState::instance().bindTexture(0, GL_TEXTURE_2D, reflectionColorBuffer);
+            GLState::instance().bindTexture(1, GL_TEXTURE_2D, refractionColorBuffer);
+            GLState::instance().bindTexture(2, GL_TEXTURE_2D, DuDvTexture);
+            GLState::instance().bindTexture(3, GL_TEXTURE_2D, normalTexture);
+            GLState::instance().bindVertexArray(waterVAO);
+            // do transformations
+            waterShader.set(waterProjection, projection);
+            // camera/view transformation
+            glm::mat4 view = camera.GetViewMatrix();
+            waterShader.set(waterView, view);
+            glm::mat4 model= glm::mat4(1.0f);
+            model = glm::scale(model, glm::vec3(2.0, 1.0, 5.0));
+            waterShader.set(waterModel, model);
+            glDrawArrays(GL_TRIANGLES, 0, 6);
+        }
         
         // std::cout << camera.Position.y << "\n";
         
@@ -463,21 +522,57 @@ int main()
         glDrawArrays(GL_TRIANGLES, 0, 6);
         */
         
+        if (frameBenchmark)
+            frameBenchmark->endFrame();
+        GLState::instance().endFrame();
+        Profiler::instance().endFrame();
+        frame++;
+        
         // check and call events and swap the buffers
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        if (window)
+        {
+            glfwSwapBuffers(window);
+            glfwPollEvents();
+        }
+        else
+            headless.present();
     }
     
+    // the render loop must not allocate once loading is done, a benchmark run that did fails
+    int exitCode = 0;
+    if (frameBenchmark)
+    {
+        frameBenchmark->finish();
+        frameBenchmark->write(benchmark.outputPath);
+        if (!frameBenchmark->allocationFree())
+        {
+            std::cout << "ERROR::BENCHMARK:: the render loop allocated after loading finished" << std::endl;
+            exitCode = 1;
+        }
+        delete frameBenchmark;
+    }
+    if (!benchmark.tracePath.empty())
+        Profiler::instance().writeChromeTrace(benchmark.tracePath);
+    
     // deallocate resources
     glDeleteVertexArrays(1, &waterVAO);
     glDeleteBuffers(1, &waterVBO);
     glDeleteFramebuffers(1, &reflectionFBO);
     glDeleteFramebuffers(1, &refractionFBO);
-    // ToDo: Delete textures, rbo
+    TextureRegistry::instance().release(texture1);
+    TextureRegistry::instance().release(texture2);
+    TextureRegistry::instance().release(normalTexture);
+    TextureRegistry::instance().release(DuDvTexture);
+    scene.clear(); // drops the last model handles
+    BufferArenas::instance().clear();
+    // ToDo: Delete rbo
     
     // glfw: terminate, clearing all previously allocated GLFW resources.
-    glfwTerminate();
-    return 0;
+    if (window)
+        glfwTerminate();
+    else
+        headless.destroy();
+    return exitCode;
 }
 
 // reflectionColorBuffer set as global var for convenience
@@ -538,69 +633,77 @@ unsigned int initializeRefractionFBO()
     return fbo;
 }
 
-// draw everything aside from water
-void renderScene(Shader wallShader, Shader modelShader, Model zenigame, Model teemo, Model duck, float clipPlane[4])
+// draw everything aside from water: the scene geometry and the frame's draw list, through the render queue. with a
+// depth shader the models' depth is laid down first from their position streams, so walls and model surfaces hidden
+// behind a model aren't shaded. model meshes are drawn at the coarsest level of detail that stays within lodErrorPixels * lodBias on
+// screen. an invalid depthShaderId skips the pre-pass
+void renderScene(const Scene &scene, const DrawList &drawList, ShaderId wallShaderId, ShaderId modelShaderId, ShaderId depthShaderId, float clipPlane[4], float lodBias)
 {
     glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texture1); // marble texture
-    
-    wallShader.use();
-    // pass clip plane
-    GLuint plane_location = glGetUniformLocation(wallShader.ID, "plane");
-    glUniform4fv(plane_location, 1, clipPlane);
-    // do transformations
-    glm::mat4 projection;
-    projection = glm::perspective(glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-    wallShader.setMat4("projection", projection);
-    // camera/view transformation
+    // camera/view transformation, the one thing that differs between the passes apart from the clip plane
     glm::mat4 view = camera.GetViewMatrix();
-    wallShader.setMat4("view", view);
-    glBindVertexArray(wallVAO);
-    glm::mat4 model= glm::mat4(1.0f);
-    wallShader.setMat4("model", model);
-    glDrawArrays(GL_TRIANGLES, 0, 24);
-    // draw floor
-    glBindVertexArray(floorVAO);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texture2); // floor texture
-    glDrawArrays(GL_TRIANGLES, 0, 6);
+    LodSelector lod(camera.Position, glm::radians(45.0f), (float)SCR_HEIGHT, lodErrorPixels * lodBias);
     
-    // draw model
-    
-    // zenigame
-    modelShader.use();
-    model = glm::mat4(1.0f); // load identity matrix
-    model = glm::translate(model, glm::vec3(0.4f, -1.0f, -2.5f));
-    model = glm::scale(model, glm::vec3(0.2f, 0.2f, 0.2f));    // it's a bit too big for our scene, so scale it down
-    modelShader.setMat4("model", model);
-    modelShader.setMat4("projection", projection);
-    modelShader.setMat4("view", view);
-    // pass clip plane to model shader`
-    plane_location = glGetUniformLocation(modelShader.ID, "plane");
-    glUniform4fv(plane_location, 1, clipPlane);
-    zenigame.Draw(modelShader);
-    
-    // teemo
-    model = glm::mat4(1.0f); // load identity matrix
-    model = glm::translate(model, glm::vec3(0.0f, 0.2f, 0.2f));
-    model = glm::scale(model, glm::vec3(0.005f, 0.005f, 0.005f));    // it's a bit too big for our scene, so scale it down
-    modelShader.setMat4("model", model);
-    modelShader.setMat4("projection", projection);
-    modelShader.setMat4("view", view);
-    teemo.Draw(modelShader); // teemo
-    
-    // duck
-    model = glm::mat4(1.0f); // load identity matrix
-    model = glm::translate(model, glm::vec3(-0.3f, 0.1f, 3.0f));
-    model = glm::scale(model, glm::vec3(0.0002f, 0.0002f, 0.0002f));    // it's a bit too big for our scene, so scale it down
-    model = glm::rotate(model, (float)glfwGetTime(), glm::vec3(0.0f, 1.0f, 0.0f));
-    modelShader.setMat4("model", model);
-    modelShader.setMat4("projection", projection);
-    modelShader.setMat4("view", view);
-    duck.Draw(modelShader);
+    // queue this pass's draws and sort them: the depth pre-pass first, then by shader, textures, vertex array and
+    // distance, so each program, texture set and vertex array is bound about once and near surfaces hide far ones
+    renderQueue.clear();
+    for (uint32_t g = 0; g < sceneGeometry.size(); g++)
+    {
+        float depth = glm::length(sceneGeometry[g].center - camera.Position) / FAR_PLANE;
+        renderQueue.submit(renderKey(RENDER_PASS_OPAQUE, wallShaderId.index, sceneGeometry[g].texture, sceneGeometry[g].vertexArray, depth), SCENE_GEOMETRY_ITEM | g);
+    }
+    if (depthShaderId.valid())
+        drawList.enqueue(renderQueue, RENDER_PASS_DEPTH, depthShaderId, camera.Position, FAR_PLANE);
+    drawList.enqueue(renderQueue, RENDER_PASS_OPAQUE, modelShaderId, camera.Position, FAR_PLANE);
+    renderQueue.sort();
+    
+    DrawState state;
+    int pass = -1;
+    const Shader* shader = NULL;
+    unsigned int shaderIndex = 0;
+    for (size_t i = 0; i < renderQueue.size(); i++)
+    {
+        const RenderCommand &command = renderQueue[i];
+        if (renderKeyPass(command.key) != pass)
+        {
+            pass = renderKeyPass(command.key);
+            shader = NULL;
+            bool depthOnly = pass == RENDER_PASS_DEPTH;
+            GLState::instance().colorMask(!depthOnly, !depthOnly, !depthOnly, !depthOnly);
+            // the pre-pass left the models' exact depth behind
+            if (!depthOnly && depthShaderId.valid())
+                GLState::instance().depthFunc(GL_LEQUAL);
+        }
+        if (!shader || renderKeyShader(command.key) != shaderIndex)
+        {
+            shaderIndex = renderKeyShader(command.key);
+            shader = &scene.shader(ShaderId(shaderIndex));
+            shader->use();
+            // do transformations
+            shader->setMat4(UNIFORM_PROJECTION, projection);
+            shader->setMat4(UNIFORM_VIEW, view);
+            // pass clip plane
+            glUniform4fv(shader->location(UNIFORM_PLANE), 1, clipPlane);
+            state.useShader(*shader);
+        }
+        
+        if (command.item & SCENE_GEOMETRY_ITEM)
+        {
+            const SceneGeometry &geometry = sceneGeometry[command.item & ~SCENE_GEOMETRY_ITEM];
+            state.setModelMatrix(SCENE_GEOMETRY_OBJECT, glm::mat4(1.0f));
+            GLState::instance().bindTexture(0, GL_TEXTURE_2D, geometry.texture);
+            GLState::instance().bindVertexArray(geometry.vertexArray);
+            glDrawArrays(GL_TRIANGLES, 0, geometry.vertexCount);
+        }
+        else if (pass == RENDER_PASS_DEPTH)
+            drawList.drawPositions(command.item, *shader, lod, state);
+        else
+            drawList.draw(command.item, *shader, lod, state);
+    }
+    GLState::instance().colorMask(true, true, true, true);
+    GLState::instance().depthFunc(GL_LESS);
 }
 
 // process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
@@ -0,0 +1,127 @@
+//
+//  mapped_file.h
+//  Graphics Engine
+//
+//  Copyright © 2017 Tony. All rights reserved.
+//
+
+#ifndef mapped_file_h
+#define mapped_file_h
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Size and modification time of a file, without opening it.
+struct FileStamp {
+    uint64_t size;
+    int64_t mtime;
+
+    bool read(const std::string &path)
+    {
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0)
+            return false;
+        size = (uint64_t)info.st_size;
+        mtime = (int64_t)info.st_mtime;
+        return true;
+    }
+};
+
+// A read-only memory mapping of a whole file, unmapped when it goes out of scope.
+class MappedFile
+{
+public:
+    MappedFile() : bytes(NULL), length(0) {}
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string &path)
+    {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0)
+        {
+            ::close(fd);
+            return false;
+        }
+        void* mapping = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd); // the mapping stays valid after closing the descriptor
+        if (mapping == MAP_FAILED)
+            return false;
+        bytes = (const unsigned char*)mapping;
+        length = (size_t)info.st_size;
+        return true;
+    }
+
+    void close()
+    {
+        if (bytes)
+            munmap((void*)bytes, length);
+        bytes = NULL;
+        length = 0;
+    }
+
+    const unsigned char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    const unsigned char* bytes;
+    size_t length;
+};
+
+// a file next to `path` to write before renaming it to `path`, named after the process and thread so two writers of
+// the same file (workers, or the engine and the model benchmark) never write into the same one
+std::string temporaryPath(const std::string &path)
+{
+    char suffix[64];
+    snprintf(suffix, sizeof(suffix), ".%d.%zx.tmp", (int)getpid(), std::hash<std::thread::id>()(std::this_thread::get_id()));
+    return path + suffix;
+}
+
+// 64 bit non-cryptographic hash of a byte range, processes 8 bytes per step.
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 0)
+{
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const unsigned char* bytes = (const unsigned char*)data;
+    uint64_t h = seed ^ (size * m);
+    size_t blocks = size / 8;
+    for (size_t i = 0; i < blocks; i++)
+    {
+        uint64_t k;
+        memcpy(&k, bytes + i * 8, 8);
+        k *= m;
+        k ^= k >> 47;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+    const unsigned char* tail = bytes + blocks * 8;
+    uint64_t k = 0;
+    for (size_t i = 0; i < (size & 7); i++)
+        k |= (uint64_t)tail[i] << (8 * i);
+    if (size & 7)
+    {
+        h ^= k;
+        h *= m;
+    }
+    h ^= h >> 47;
+    h *= m;
+    h ^= h >> 47;
+    return h;
+}
+
+#endif /* mapped_file_h */
@@ -15,133 +15,338 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include "shader.h"
+#include "gl_state.h"
+#include "load_stats.h"
+#include "vertex_format.h"
+#include "buffer_arena.h"
+#include "texture_arrays.h"
 
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <vector>
 using namespace std;
 
-struct Vertex {
-    // position
-    glm::vec3 Position;
-    // normal
-    glm::vec3 Normal;
-    // texCoords
-    glm::vec2 TexCoords;
-    // tangent
-    glm::vec3 Tangent;
-    // bitangent
-    glm::vec3 Bitangent;
-};
-
 struct Texture {
     unsigned int id;
     string type;
     string path;
 };
 
+// uniforms every mesh draw sets, hashed at compile time
+constexpr UniformName UNIFORM_MATERIAL_ARRAY("materialArray");
+constexpr UniformName UNIFORM_MATERIAL_LAYER("materialLayer");
+constexpr UniformName UNIFORM_POSITION_OFFSET("positionOffset");
+constexpr UniformName UNIFORM_POSITION_SCALE("positionScale");
+
+// vertices 16-bit indices can address
+const size_t SHORT_INDEX_VERTICES = 65536;
+
+// the index type of a mesh: 16-bit whenever its vertices fit, which halves the index memory and fetch bandwidth and
+// is the usual case as the loader splits bigger meshes (see splitMesh)
+inline GLenum meshIndexType(size_t vertexCount)
+{
+    return vertexCount <= SHORT_INDEX_VERTICES ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
+inline size_t indexTypeSize(GLenum indexType)
+{
+    return indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned int);
+}
+
+// One level of detail: a range of the mesh's indices, all levels share its vertices (see MeshSimplifier)
+struct MeshLod {
+    uint32_t indexOffset;
+    uint32_t indexCount;
+    float error; // how far the level's surface may be off the full mesh, in model units
+};
+
+// A mesh's vertices and indices as its arena holds them, with the bounds setupMesh derives from the vertices: what
+// the mesh cache stores, so warm loads upload without touching a vertex.
+struct MeshStreams {
+    const void* attributes; // attribute stream as VertexArena::layOut lays it out
+    const void* positions;  // position stream, NULL unless the positions are split off (see meshPositionStreams)
+    size_t vertexCount;
+    const void* indices;    // of meshIndexType(vertexCount)
+    size_t indexCount;
+    PositionQuantization quantization;
+    glm::vec3 boundsCenter;
+    float boundsRadius;
+};
+
 class Mesh {
 public:
     /*  Mesh Data  */
     vector<Vertex> vertices;
-    vector<unsigned int> indices;
+    vector<unsigned int> indices; // of every level of detail, one after another
     vector<Texture> textures;
-    unsigned int VAO;
+    vector<MeshLod> lods;         // finest first, lods[0] is the full mesh
+    unsigned int VAO;         // of the mesh's arena, shared with the meshes laid out like it
+    unsigned int positionVAO; // position-only vertex array, VAO itself unless the positions have a stream of their own
+    unsigned int indexCount; // of all levels
+    GLenum indexType;        // see meshIndexType
+    glm::vec3 boundsCenter;  // bounding sphere
+    float boundsRadius;
+    unsigned int attributes; // ATTRIBUTE_* in the vertex buffer besides the position, see formatAttributes
+    VertexFormat format;
+    PositionQuantization quantization; // decode of packed positions
     
     /*  Functions  */
-    // constructor
-    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+    // constructor, only `attributes` end up in the vertex buffer. without `lods` all indices are one level
+    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures, unsigned int attributes = ATTRIBUTES_ALL, vector<MeshLod> lods = vector<MeshLod>()) : attributes(attributes)
     {
-        this->vertices = vertices;
-        this->indices = indices;
-        this->textures = textures;
+        this->vertices = std::move(vertices);
+        this->indices = std::move(indices);
+        this->textures = std::move(textures);
+        this->lods = std::move(lods);
+        nameSamplers();
         
         // now that we have all the required data, set the vertex buffers and its attribute pointers.
-        setupMesh();
+        // the indices are narrowed to 16 bits first if the vertices fit them
+        GLenum type = meshIndexType(this->vertices.size());
+        vector<uint16_t> shortIndices;
+        const void* indexData = this->indices.empty() ? NULL : &this->indices[0];
+        if(type == GL_UNSIGNED_SHORT && !this->indices.empty())
+        {
+            shortIndices.assign(this->indices.begin(), this->indices.end());
+            indexData = &shortIndices[0];
+        }
+        setupMesh(this->vertices.empty() ? NULL : &this->vertices[0], this->vertices.size(), indexData, this->indices.size(), type);
+    }
+    
+    // constructor that uploads streams laid out for the current vertex format and position streams straight from
+    // memory owned by someone else (e.g. a mapped mesh cache). the vertices and indices vectors stay empty.
+    Mesh(const MeshStreams &streams, vector<Texture> textures, unsigned int attributes, vector<MeshLod> lods) : attributes(attributes)
+    {
+        this->textures = std::move(textures);
+        this->lods = std::move(lods);
+        nameSamplers();
+        
+        LoadTimer timer(modelLoadStats().uploadMs);
+        format = meshVertexFormat();
+        this->attributes = formatAttributes(this->attributes, format);
+        quantization = streams.quantization;
+        boundsCenter = streams.boundsCenter;
+        boundsRadius = streams.boundsRadius;
+        indexType = meshIndexType(streams.vertexCount);
+        setupLods(streams.indexCount);
+        arena = &BufferArenas::instance().arenaFor(attributes, format, meshPositionStreams());
+        allocation = arena->allocate(streams.attributes, streams.positions, streams.vertexCount, streams.indices, streams.indexCount * indexTypeSize(indexType));
+        VAO = arena->VAO;
+        positionVAO = arena->positionVAO;
+    }
+    
+    // the arena the mesh's vertices and indices live in
+    const VertexArena& vertexArena() const
+    {
+        return *arena;
     }
     
-    // render the mesh
-    void Draw(Shader shader)
+    // render the mesh at a level of detail (see LodSelector)
+    // textures in `overrides` replace the mesh's own texture of the same type. a first diffuse texture that is packed
+    // into a texture array (see TextureArrays) is sampled from its layer, "materialArray" at "materialLayer". textures
+    // and vertex arrays are bound through GLState, so meshes sharing them with the mesh drawn before don't bind them
+    // again, and the vertex array stays bound afterwards
+    void Draw(const Shader &shader, const vector<Texture> &overrides = vector<Texture>(), unsigned int lod = 0) const
     {
         // bind appropriate textures
+        int materialLayer = -1;
+        for(unsigned int i = 0; i < textures.size(); i++)
+        {
+            unsigned int id = textureFor(textures[i], overrides);
+            if((int)i == firstDiffuse)
+            {
+                const TextureLayer* layer = TextureArrays::instance().find(id);
+                if(layer)
+                {
+                    GLState::instance().bindTexture(MATERIAL_ARRAY_UNIT, GL_TEXTURE_2D_ARRAY, layer->array);
+                    materialLayer = layer->layer;
+                    continue;
+                }
+            }
+            // set the sampler to the correct texture unit
+            glUniform1i(shader.location(samplers[i]), i);
+            // and bind the texture to it
+            GLState::instance().bindTexture(i, GL_TEXTURE_2D, id);
+        }
+        // materialArray always gets its own unit, samplers of different types must not share one even when unused
+        glUniform1i(shader.location(UNIFORM_MATERIAL_ARRAY), MATERIAL_ARRAY_UNIT);
+        glUniform1i(shader.location(UNIFORM_MATERIAL_LAYER), materialLayer);
+        
+        if(format == VERTEX_PACKED)
+        {
+            glUniform3fv(shader.location(UNIFORM_POSITION_OFFSET), 1, &quantization.offset[0]);
+            glUniform3fv(shader.location(UNIFORM_POSITION_SCALE), 1, &quantization.scale[0]);
+        }
+        
+        // draw mesh
+        drawElements(VAO, lod);
+    }
+    
+    // the texture the mesh's draws are grouped by (see RenderQueue): the texture array its first diffuse texture is
+    // packed into, or else that texture itself; 0 without a diffuse texture
+    unsigned int material(const vector<Texture> &overrides = vector<Texture>()) const
+    {
+        if(firstDiffuse < 0)
+            return 0;
+        unsigned int id = textureFor(textures[firstDiffuse], overrides);
+        const TextureLayer* layer = TextureArrays::instance().find(id);
+        return layer ? layer->array : id;
+    }
+    
+    // draws the mesh for a shader that only reads positions (attribute 0), no textures are bound
+    void DrawPositions(const Shader &shader, unsigned int lod = 0) const
+    {
+        if(format == VERTEX_PACKED)
+        {
+            glUniform3fv(shader.location(UNIFORM_POSITION_OFFSET), 1, &quantization.offset[0]);
+            glUniform3fv(shader.location(UNIFORM_POSITION_SCALE), 1, &quantization.scale[0]);
+        }
+        
+        drawElements(positionVAO, lod);
+    }
+    
+    // gives the mesh's space in its arena back, textures are owned by the model
+    void Delete()
+    {
+        arena->free(allocation);
+    }
+    
+private:
+    /*  Render data  */
+    VertexArena* arena;
+    VertexArena::Allocation allocation;
+    vector<UniformName> samplers; // sampler each texture is bound to, named and hashed once so drawing builds no strings
+    int firstDiffuse;        // index of the first diffuse texture, -1 if there is none
+    
+    /*  Functions    */
+    // names the samplers after the texture types, numbered per type: texture_diffuseN, texture_specularN, ...
+    void nameSamplers()
+    {
         unsigned int diffuseNr  = 1;
         unsigned int specularNr = 1;
         unsigned int normalNr   = 1;
         unsigned int heightNr   = 1;
+        firstDiffuse = -1;
+        samplers.clear();
         for(unsigned int i = 0; i < textures.size(); i++)
         {
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
             // retrieve texture number (the N in diffuse_textureN)
             string number;
-            string name = textures[i].type;
+            const string &name = textures[i].type;
             if(name == "texture_diffuse")
+            {
+                if(firstDiffuse < 0)
+                    firstDiffuse = (int)i;
                 number = std::to_string(diffuseNr++);
+            }
             else if(name == "texture_specular")
                 number = std::to_string(specularNr++); // transfer unsigned int to stream
             else if(name == "texture_normal")
                 number = std::to_string(normalNr++); // transfer unsigned int to stream
             else if(name == "texture_height")
                 number = std::to_string(heightNr++); // transfer unsigned int to stream
-            
-            // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
-            // and finally bind the texture
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
+            samplers.push_back(UniformName((name + number).c_str()));
         }
-        
-        // draw mesh
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
-        
-        // always good practice to set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
     }
     
-private:
-    /*  Render data  */
-    unsigned int VBO, EBO;
+    // the texture bound for one of the mesh's textures, the first override of the same type wins
+    static unsigned int textureFor(const Texture &texture, const vector<Texture> &overrides)
+    {
+        for(unsigned int i = 0; i < overrides.size(); i++)
+            if(overrides[i].type == texture.type)
+                return overrides[i].id;
+        return texture.id;
+    }
+    
+    // draws a level from the arena's buffers through one of its vertex arrays
+    void drawElements(unsigned int vertexArray, unsigned int lod) const
+    {
+        GLState::instance().bindVertexArray(vertexArray);
+        const void* offset = (const void*)(allocation.indexOffset + lods[lod].indexOffset * indexTypeSize(indexType));
+        glDrawElementsBaseVertex(GL_TRIANGLES, lods[lod].indexCount, indexType, offset, (GLint)allocation.firstVertex);
+    }
+    
+    // without levels of detail all indices are one level
+    void setupLods(size_t indexCount)
+    {
+        this->indexCount = (unsigned int)indexCount;
+        if(lods.empty())
+        {
+            MeshLod full = { 0, (uint32_t)indexCount, 0.0f };
+            lods.push_back(full);
+        }
+    }
     
-    /*  Functions    */
     // initializes all the buffer objects/arrays
-    void setupMesh()
+    void setupMesh(const Vertex* vertexData, size_t vertexCount, const void* indexData, size_t indexCount, GLenum type)
     {
-        // create buffers/arrays
-        glGenVertexArrays(1, &VAO);
-        glGenBuffers(1, &VBO);
-        glGenBuffers(1, &EBO);
+        LoadTimer timer(modelLoadStats().uploadMs);
+        setupLods(indexCount);
+        format = meshVertexFormat();
+        this->attributes = formatAttributes(this->attributes, format);
+        quantization = quantizePositions(vertexData, vertexCount);
+        // the bounding box's sphere, enough to judge the mesh's size on screen
+        boundsCenter = quantization.offset + quantization.scale * 0.5f;
+        boundsRadius = 0.0f;
+        for(size_t i = 0; i < vertexCount; i++)
+            boundsRadius = std::max(boundsRadius, glm::length(vertexData[i].Position - boundsCenter));
+        indexType = type;
         
-        glBindVertexArray(VAO);
-        // load data into vertex buffers
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        // A great thing about structs is that their memory layout is sequential for all its items.
-        // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
-        // again translates to 3/2 floats which translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
-        
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
-        
-        // set the vertex attribute pointers
-        // vertex Positions
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-        // vertex normals
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-        // vertex texture coords
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-        // vertex tangent
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
-        // vertex bitangent
-        glEnableVertexAttribArray(4);
-        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
-        
-        glBindVertexArray(0);
+        // suballocate the vertices, laid out with just the attributes the mesh keeps (see VertexLayout), and the
+        // indices from the arena of meshes with the same layout
+        arena = &BufferArenas::instance().arenaFor(attributes, format, meshPositionStreams());
+        allocation = arena->allocate(vertexData, vertexCount, indexData, indexCount * indexTypeSize(indexType), quantization);
+        VAO = arena->VAO;
+        positionVAO = arena->positionVAO;
+    }
+};
+
+// the largest factor a transform scales lengths by
+inline float transformScale(const glm::mat4 &transform)
+{
+    return std::max(glm::length(glm::vec3(transform[0])), std::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+}
+
+// Picks a mesh's level of detail from its size on screen: the coarsest level whose error projects to at most
+// maxErrorPixels, measured at the point of the mesh's bounding sphere closest to the eye.
+struct LodSelector {
+    glm::vec3 eye;
+    float pixelsPerUnit;  // pixels a unit long object covers at distance 1
+    float maxErrorPixels; // 0 always picks the full mesh
+
+    LodSelector() : eye(0.0f), pixelsPerUnit(0.0f), maxErrorPixels(0.0f) {}
+    
+    // for a perspective projection with vertical field of view `fovy` (radians) onto a viewport `viewportHeight` pixels tall
+    LodSelector(const glm::vec3 &eye, float fovy, float viewportHeight, float maxErrorPixels)
+        : eye(eye), pixelsPerUnit(viewportHeight / (2.0f * std::tan(fovy * 0.5f))), maxErrorPixels(maxErrorPixels) {}
+    
+    unsigned int select(const Mesh &mesh, const glm::mat4 &transform) const
+    {
+        if(maxErrorPixels <= 0.0f || mesh.lods.size() < 2)
+            return 0;
+        float scale = transformScale(transform);
+        return select(mesh, glm::vec3(transform * glm::vec4(mesh.boundsCenter, 1.0f)), mesh.boundsRadius * scale, scale);
+    }
+    
+    // the same for a mesh already placed by a transform scaling by `scale`: its bounding sphere is at `center` with
+    // `radius` in world space
+    unsigned int select(const Mesh &mesh, const glm::vec3 &center, float radius, float scale) const
+    {
+        if(maxErrorPixels <= 0.0f || mesh.lods.size() < 2)
+            return 0;
+        float distance = glm::length(center - eye) - radius;
+        if(distance <= 0.0f)
+            return 0;
+        float pixelsPerModelUnit = pixelsPerUnit * scale / distance;
+        unsigned int lod = 0;
+        while(lod + 1 < mesh.lods.size() && mesh.lods[lod + 1].error * pixelsPerModelUnit <= maxErrorPixels)
+            lod++;
+        return lod;
     }
 };
 
@@ -0,0 +1,408 @@
+//
+//  mesh_cache.h
+//  Graphics Engine
+//
+//  Copyright © 2017 Tony. All rights reserved.
+//
+
+#ifndef mesh_cache_h
+#define mesh_cache_h
+
+#include "mesh.h"
+#include "mapped_file.h"
+#include "obj_loader.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Binary cache of a model's processed meshes, so warm starts skip Assimp entirely and upload the meshes without
+// touching a vertex. The vertices are stored laid out for one set of vertex settings (attributes, format, position
+// streams), a model loaded with different settings has a cache for each.
+//
+// Layout: MeshCacheHeader, MeshCacheEntry[meshCount], then per mesh its texture records
+// (uint32 type length, uint32 path length, both strings without terminator), its attribute stream and its position
+// stream (if the positions are split off) exactly as its VertexArena holds them (each 16 byte aligned), its indices
+// of all levels of detail in the width the mesh draws them with, see meshIndexType (4 byte aligned), and its MeshLod
+// records (4 byte aligned).
+// Bump MESH_CACHE_VERSION whenever the layout or the content of the meshes changes.
+const uint32_t MESH_CACHE_VERSION = 9;
+
+// Identifies the exact input a cache was built from: the model file and, for an OBJ, the material libraries it
+// references, which name the meshes' textures, and the settings its vertices were laid out with.
+struct MeshCacheKey {
+    FileStamp stamp;
+    uint64_t hash;
+    FileStamp materialStamp; // of all material libraries together: total size, latest modification
+    uint64_t materialHash;   // of their names and contents, libraries that can't be read count by name only
+    uint32_t importFlags;
+    uint32_t vertexAttributes; // ATTRIBUTE_* the model's shader reads, meshes keep these or fewer
+    uint32_t vertexFormat;     // VertexFormat
+    uint32_t positionStreams;  // 1 if the positions are split off
+
+    // stats and hashes the source file and its material libraries
+    bool read(const string &sourcePath, uint32_t flags, unsigned int attributes, VertexFormat format, bool splitPositions)
+    {
+        MappedFile source;
+        if (!stamp.read(sourcePath) || !source.open(sourcePath))
+            return false;
+        hash = hashBytes(source.data(), source.size());
+        materialStamp.size = 0;
+        materialStamp.mtime = 0;
+        materialHash = 0;
+        if (sourcePath.size() > 4 && sourcePath.compare(sourcePath.size() - 4, 4, ".obj") == 0)
+        {
+            string directory = sourcePath.substr(0, sourcePath.find_last_of('/'));
+            vector<string> libraries = ObjLoader::materialLibraries((const char*)source.data(), source.size());
+            for (size_t i = 0; i < libraries.size(); i++)
+            {
+                materialHash = hashBytes(libraries[i].data(), libraries[i].size(), materialHash);
+                FileStamp libraryStamp;
+                MappedFile library;
+                if (!libraryStamp.read(directory + '/' + libraries[i]) || !library.open(directory + '/' + libraries[i]))
+                    continue;
+                materialStamp.size += libraryStamp.size;
+                materialStamp.mtime = std::max(materialStamp.mtime, libraryStamp.mtime);
+                materialHash = hashBytes(library.data(), library.size(), materialHash);
+            }
+        }
+        importFlags = flags;
+        vertexAttributes = attributes & ATTRIBUTES_ALL;
+        vertexFormat = format;
+        positionStreams = splitPositions ? 1 : 0;
+        return true;
+    }
+
+    // hash of the settings the vertices are laid out with, in hex
+    string settingsDigest() const
+    {
+        uint32_t settings[3] = { vertexAttributes, vertexFormat, positionStreams };
+        char digest[16];
+        snprintf(digest, sizeof(digest), "%08x", (uint32_t)hashBytes(settings, sizeof(settings)));
+        return digest;
+    }
+};
+
+struct MeshCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t importFlags;
+    uint32_t vertexAttributes;
+    uint32_t vertexFormat;
+    uint32_t positionStreams;
+    uint64_t sourceSize;
+    int64_t sourceMtime;
+    uint64_t sourceHash;
+    uint64_t materialSize;
+    int64_t materialMtime;
+    uint64_t materialHash;
+    uint32_t meshCount;
+    uint32_t reserved;
+};
+
+struct MeshCacheEntry {
+    uint64_t textureOffset;
+    uint64_t vertexOffset;   // attribute stream
+    uint64_t positionOffset; // position stream, 0 unless the positions are split off
+    uint64_t indexOffset;
+    uint64_t lodOffset;
+    uint32_t textureCount;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t lodCount;
+    uint32_t indexSize;  // bytes per index, 2 or 4
+    uint32_t attributes; // ATTRIBUTE_* the mesh keeps
+    float quantizationOffset[3], quantizationScale[3];
+    float boundsCenter[3], boundsRadius;
+};
+
+class MeshCache
+{
+public:
+    // the cache file that belongs to a model file loaded with the settings of `key`
+    static string pathFor(const string &sourcePath, const MeshCacheKey &key)
+    {
+        return sourcePath + "." + key.settingsDigest() + ".meshcache";
+    }
+
+    // maps the cache, fails if it is missing, corrupt or was built from different input. every index is checked
+    // against its mesh's vertex count, so a damaged cache can't make the GPU fetch vertices out of bounds
+    bool open(const string &cachePath, const MeshCacheKey &key)
+    {
+        if (!file.open(cachePath) || file.size() < sizeof(MeshCacheHeader))
+            return false;
+        const MeshCacheHeader* header = (const MeshCacheHeader*)file.data();
+        if (memcmp(header->magic, "GEMC", 4) != 0 || header->version != MESH_CACHE_VERSION
+            || header->importFlags != key.importFlags || header->vertexAttributes != key.vertexAttributes
+            || header->vertexFormat != key.vertexFormat || header->positionStreams != key.positionStreams
+            || header->sourceSize != key.stamp.size
+            || header->sourceMtime != key.stamp.mtime || header->sourceHash != key.hash
+            || header->materialSize != key.materialStamp.size || header->materialMtime != key.materialStamp.mtime
+            || header->materialHash != key.materialHash)
+        {
+            file.close();
+            return false;
+        }
+        // make sure every blob lies inside the file
+        if (sizeof(MeshCacheHeader) + (uint64_t)header->meshCount * sizeof(MeshCacheEntry) > file.size())
+        {
+            file.close();
+            return false;
+        }
+        for (uint32_t i = 0; i < header->meshCount; i++)
+        {
+            const MeshCacheEntry &e = entry(i);
+            size_t vertexStride, positionStride;
+            strides(e.attributes, key, vertexStride, positionStride);
+            if ((e.attributes & ~key.vertexAttributes) != 0 || e.indexSize != indexTypeSize(meshIndexType(e.vertexCount))
+                || e.vertexOffset + (uint64_t)e.vertexCount * vertexStride > file.size()
+                || (e.positionOffset != 0) != (positionStride > 0)
+                || e.positionOffset + (uint64_t)e.vertexCount * positionStride > file.size()
+                || e.indexOffset + (uint64_t)e.indexCount * e.indexSize > file.size()
+                || e.lodOffset + (uint64_t)e.lodCount * sizeof(MeshLod) > file.size()
+                || e.textureOffset > file.size())
+            {
+                file.close();
+                return false;
+            }
+            const MeshLod* levels = (const MeshLod*)(file.data() + e.lodOffset);
+            for (uint32_t l = 0; l < e.lodCount; l++)
+            {
+                if ((uint64_t)levels[l].indexOffset + levels[l].indexCount > e.indexCount)
+                {
+                    file.close();
+                    return false;
+                }
+            }
+            const unsigned char* meshIndices = file.data() + e.indexOffset;
+            if (e.indexSize == sizeof(uint16_t) ? !indicesBelow((const uint16_t*)meshIndices, e.indexCount, e.vertexCount)
+                                                : !indicesBelow((const unsigned int*)meshIndices, e.indexCount, e.vertexCount))
+            {
+                file.close();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    uint32_t meshCount() const
+    {
+        return ((const MeshCacheHeader*)file.data())->meshCount;
+    }
+
+    const MeshCacheEntry& entry(uint32_t mesh) const
+    {
+        return ((const MeshCacheEntry*)(file.data() + sizeof(MeshCacheHeader)))[mesh];
+    }
+
+    // a mesh's vertices and indices, ready for Mesh to upload
+    MeshStreams streams(uint32_t mesh) const
+    {
+        const MeshCacheEntry &e = entry(mesh);
+        MeshStreams streams;
+        streams.attributes = file.data() + e.vertexOffset;
+        streams.positions = e.positionOffset ? file.data() + e.positionOffset : NULL;
+        streams.vertexCount = e.vertexCount;
+        streams.indices = file.data() + e.indexOffset;
+        streams.indexCount = e.indexCount;
+        streams.quantization.offset = glm::vec3(e.quantizationOffset[0], e.quantizationOffset[1], e.quantizationOffset[2]);
+        streams.quantization.scale = glm::vec3(e.quantizationScale[0], e.quantizationScale[1], e.quantizationScale[2]);
+        streams.boundsCenter = glm::vec3(e.boundsCenter[0], e.boundsCenter[1], e.boundsCenter[2]);
+        streams.boundsRadius = e.boundsRadius;
+        return streams;
+    }
+
+    // levels of detail, ranges of indices(mesh)
+    vector<MeshLod> lods(uint32_t mesh) const
+    {
+        const MeshLod* levels = (const MeshLod*)(file.data() + entry(mesh).lodOffset);
+        return vector<MeshLod>(levels, levels + entry(mesh).lodCount);
+    }
+
+    // texture references as (type, path relative to the model directory)
+    vector<pair<string, string> > textures(uint32_t mesh) const
+    {
+        vector<pair<string, string> > result;
+        const MeshCacheEntry &e = entry(mesh);
+        uint64_t offset = e.textureOffset;
+        for (uint32_t i = 0; i < e.textureCount; i++)
+        {
+            uint32_t lengths[2];
+            if (offset + sizeof(lengths) > file.size())
+                break;
+            memcpy(lengths, file.data() + offset, sizeof(lengths));
+            offset += sizeof(lengths);
+            if (offset + lengths[0] + lengths[1] > file.size())
+                break;
+            const char* chars = (const char*)file.data() + offset;
+            result.push_back(make_pair(string(chars, lengths[0]), string(chars + lengths[0], lengths[1])));
+            offset += lengths[0] + lengths[1];
+        }
+        return result;
+    }
+
+    void close()
+    {
+        file.close();
+    }
+
+    // writes the cache for a freshly imported model, through a temporary file of its own (see temporaryPath) so
+    // readers never see a partial cache
+    static bool write(const string &cachePath, const MeshCacheKey &key, const vector<Mesh> &meshes)
+    {
+        MeshCacheHeader header;
+        memcpy(header.magic, "GEMC", 4);
+        header.version = MESH_CACHE_VERSION;
+        header.importFlags = key.importFlags;
+        header.vertexAttributes = key.vertexAttributes;
+        header.vertexFormat = key.vertexFormat;
+        header.positionStreams = key.positionStreams;
+        header.sourceSize = key.stamp.size;
+        header.sourceMtime = key.stamp.mtime;
+        header.sourceHash = key.hash;
+        header.materialSize = key.materialStamp.size;
+        header.materialMtime = key.materialStamp.mtime;
+        header.materialHash = key.materialHash;
+        header.meshCount = (uint32_t)meshes.size();
+        header.reserved = 0;
+
+        // lay out the blobs
+        vector<MeshCacheEntry> entries(meshes.size());
+        uint64_t offset = sizeof(MeshCacheHeader) + meshes.size() * sizeof(MeshCacheEntry);
+        for (size_t i = 0; i < meshes.size(); i++)
+        {
+            const Mesh &mesh = meshes[i];
+            MeshCacheEntry &e = entries[i];
+            e.textureOffset = offset;
+            e.textureCount = (uint32_t)mesh.textures.size();
+            for (size_t t = 0; t < mesh.textures.size(); t++)
+                offset += 2 * sizeof(uint32_t) + mesh.textures[t].type.size() + mesh.textures[t].path.size();
+            // the meshes must have been laid out with the settings of the key
+            size_t vertexStride, positionStride;
+            strides(mesh.attributes, key, vertexStride, positionStride);
+            if (vertexStride != mesh.vertexArena().vertexStride() || positionStride != mesh.vertexArena().positionStride())
+                return false;
+            offset = align(offset, 16);
+            e.vertexOffset = offset;
+            e.vertexCount = (uint32_t)mesh.vertices.size();
+            offset += mesh.vertices.size() * vertexStride;
+            offset = align(offset, 16);
+            e.positionOffset = positionStride > 0 ? offset : 0;
+            offset += mesh.vertices.size() * positionStride;
+            offset = align(offset, 4);
+            e.indexOffset = offset;
+            e.indexCount = (uint32_t)mesh.indices.size();
+            e.indexSize = (uint32_t)indexTypeSize(mesh.indexType);
+            e.attributes = mesh.attributes;
+            for (int c = 0; c < 3; c++)
+            {
+                e.quantizationOffset[c] = mesh.quantization.offset[c];
+                e.quantizationScale[c] = mesh.quantization.scale[c];
+                e.boundsCenter[c] = mesh.boundsCenter[c];
+            }
+            e.boundsRadius = mesh.boundsRadius;
+            offset += mesh.indices.size() * e.indexSize;
+            offset = align(offset, 4);
+            e.lodOffset = offset;
+            e.lodCount = (uint32_t)mesh.lods.size();
+            offset += mesh.lods.size() * sizeof(MeshLod);
+        }
+
+        string tempPath = temporaryPath(cachePath);
+        FILE* out = fopen(tempPath.c_str(), "wb");
+        if (!out)
+            return false;
+        bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+        if (!entries.empty())
+            ok = ok && fwrite(&entries[0], sizeof(MeshCacheEntry), entries.size(), out) == entries.size();
+        for (size_t i = 0; i < meshes.size() && ok; i++)
+        {
+            const Mesh &mesh = meshes[i];
+            for (size_t t = 0; t < mesh.textures.size(); t++)
+            {
+                uint32_t lengths[2] = { (uint32_t)mesh.textures[t].type.size(), (uint32_t)mesh.textures[t].path.size() };
+                ok = ok && fwrite(lengths, sizeof(lengths), 1, out) == 1;
+                ok = ok && fwrite(mesh.textures[t].type.data(), 1, lengths[0], out) == lengths[0];
+                ok = ok && fwrite(mesh.textures[t].path.data(), 1, lengths[1], out) == lengths[1];
+            }
+            // the vertices laid out by the mesh's arena
+            const VertexArena &arena = mesh.vertexArena();
+            size_t count = mesh.vertices.size();
+            vector<unsigned char> attributes(count * arena.vertexStride()), positions(count * arena.positionStride());
+            if (count > 0)
+                arena.layOut(&mesh.vertices[0], count, mesh.quantization, attributes.empty() ? NULL : &attributes[0],
+                             positions.empty() ? NULL : &positions[0]);
+            ok = ok && pad(out, entries[i].vertexOffset);
+            if (!attributes.empty())
+                ok = ok && fwrite(&attributes[0], 1, attributes.size(), out) == attributes.size();
+            if (!positions.empty())
+            {
+                ok = ok && pad(out, entries[i].positionOffset);
+                ok = ok && fwrite(&positions[0], 1, positions.size(), out) == positions.size();
+            }
+            ok = ok && pad(out, entries[i].indexOffset);
+            if (!mesh.indices.empty() && mesh.indexType == GL_UNSIGNED_SHORT)
+            {
+                vector<uint16_t> shortIndices(mesh.indices.begin(), mesh.indices.end());
+                ok = ok && fwrite(&shortIndices[0], sizeof(uint16_t), shortIndices.size(), out) == shortIndices.size();
+            }
+            else if (!mesh.indices.empty())
+                ok = ok && fwrite(&mesh.indices[0], sizeof(unsigned int), mesh.indices.size(), out) == mesh.indices.size();
+            ok = ok && pad(out, entries[i].lodOffset);
+            if (!mesh.lods.empty())
+                ok = ok && fwrite(&mesh.lods[0], sizeof(MeshLod), mesh.lods.size(), out) == mesh.lods.size();
+        }
+        ok = fclose(out) == 0 && ok;
+        if (!ok || rename(tempPath.c_str(), cachePath.c_str()) != 0)
+        {
+            remove(tempPath.c_str());
+            std::cout << "WARNING::MESH_CACHE:: Could not write " << cachePath << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    MappedFile file;
+
+    // bytes a vertex of a mesh keeping `attributes` takes in its attribute and position streams, laid out with the
+    // settings of `key`
+    static void strides(unsigned int attributes, const MeshCacheKey &key, size_t &vertexStride, size_t &positionStride)
+    {
+        VertexFormat format = (VertexFormat)key.vertexFormat;
+        vertexStride = vertexLayout(attributes, format, !key.positionStreams).stride;
+        positionStride = key.positionStreams ? vertexLayout(0, format).stride : 0;
+    }
+
+    template <typename Index>
+    static bool indicesBelow(const Index* indices, uint32_t count, uint32_t vertexCount)
+    {
+        for (uint32_t i = 0; i < count; i++)
+            if (indices[i] >= vertexCount)
+                return false;
+        return true;
+    }
+
+    static uint64_t align(uint64_t offset, uint64_t alignment)
+    {
+        return (offset + alignment - 1) & ~(alignment - 1);
+    }
+
+    // writes zeros up to the given file offset
+    static bool pad(FILE* out, uint64_t offset)
+    {
+        long position = ftell(out);
+        while (position >= 0 && (uint64_t)position < offset)
+        {
+            if (fputc(0, out) == EOF)
+                return false;
+            position++;
+        }
+        return position >= 0;
+    }
+};
+
+#endif /* mesh_cache_h */
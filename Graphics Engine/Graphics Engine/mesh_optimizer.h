@@ -0,0 +1,237 @@
+//
+//  mesh_optimizer.h
+//  Graphics Engine
+//
+//  Copyright © 2017 Tony. All rights reserved.
+//
+
+#ifndef mesh_optimizer_h
+#define mesh_optimizer_h
+
+#include "load_stats.h"
+#include "mapped_file.h"
+#include "mesh.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+using namespace std;
+
+// Load-time mesh optimization: welds identical vertices, orders the triangles for the post-transform vertex cache
+// and the vertices for fetch locality. Doesn't touch GL, meant to run on the loader threads.
+
+// entries of the FIFO post-transform cache the statistics simulate and the triangle order is tuned for
+const unsigned int VERTEX_CACHE_SIZE = 16;
+
+// cache misses of drawing the triangles in order through a FIFO vertex cache
+size_t countCacheMisses(const vector<unsigned int> &indices, size_t vertexCount, unsigned int cacheSize = VERTEX_CACHE_SIZE)
+{
+    // a vertex is in the cache while fewer than cacheSize misses happened since it was loaded
+    vector<size_t> loadedAt(vertexCount, 0);
+    size_t misses = 0;
+    for (size_t i = 0; i < indices.size(); i++)
+    {
+        unsigned int v = indices[i];
+        if (loadedAt[v] == 0 || misses - loadedAt[v] >= cacheSize)
+        {
+            misses++;
+            loadedAt[v] = misses;
+        }
+    }
+    return misses;
+}
+
+// merges vertices whose attributes are bitwise identical and remaps the indices
+void weldVertices(vector<Vertex> &vertices, vector<unsigned int> &indices)
+{
+    size_t tableSize = 1;
+    while (tableSize < vertices.size() * 2)
+        tableSize *= 2;
+    const unsigned int EMPTY = ~0u;
+    vector<unsigned int> table(tableSize, EMPTY);
+    vector<unsigned int> remap(vertices.size());
+    size_t unique = 0;
+    for (size_t i = 0; i < vertices.size(); i++)
+    {
+        size_t slot = (size_t)hashBytes(&vertices[i], sizeof(Vertex)) & (tableSize - 1);
+        while (table[slot] != EMPTY && memcmp(&vertices[table[slot]], &vertices[i], sizeof(Vertex)) != 0)
+            slot = (slot + 1) & (tableSize - 1);
+        if (table[slot] == EMPTY)
+        {
+            vertices[unique] = vertices[i];
+            table[slot] = (unsigned int)unique++;
+        }
+        remap[i] = table[slot];
+    }
+    vertices.resize(unique);
+    for (size_t i = 0; i < indices.size(); i++)
+        indices[i] = remap[indices[i]];
+}
+
+// reorders the triangles for the post-transform cache with Tipsify (Sander, Nehab and Barczak 2007): it fans around
+// one vertex after another, choosing the next one among the vertices still in the cache, linear in the mesh size
+void optimizeVertexCache(vector<unsigned int> &indices, size_t vertexCount, unsigned int cacheSize = VERTEX_CACHE_SIZE)
+{
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0 || vertexCount == 0)
+        return;
+
+    // triangles around each vertex
+    vector<unsigned int> live(vertexCount, 0);
+    for (size_t i = 0; i < triangleCount * 3; i++)
+        live[indices[i]]++;
+    vector<unsigned int> offsets(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; v++)
+        offsets[v + 1] = offsets[v] + live[v];
+    vector<unsigned int> adjacency(offsets[vertexCount]);
+    vector<unsigned int> filled(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < triangleCount * 3; i++)
+        adjacency[filled[indices[i]]++] = (unsigned int)(i / 3);
+
+    vector<unsigned int> result;
+    result.reserve(triangleCount * 3);
+    vector<unsigned int> cacheTime(vertexCount, 0);
+    vector<bool> emitted(triangleCount, false);
+    vector<unsigned int> deadEnd;
+    vector<unsigned int> candidates;
+    unsigned int time = cacheSize + 1;
+    size_t cursor = 0;
+    long long fanning = 0;
+    while (fanning >= 0)
+    {
+        // emit the remaining triangles around the vertex
+        candidates.clear();
+        for (unsigned int a = offsets[fanning]; a < offsets[fanning + 1]; a++)
+        {
+            unsigned int t = adjacency[a];
+            if (emitted[t])
+                continue;
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int v = indices[t * 3 + k];
+                result.push_back(v);
+                deadEnd.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+                if (time - cacheTime[v] > cacheSize)
+                    cacheTime[v] = time++;
+            }
+            emitted[t] = true;
+        }
+
+        // next: the candidate that stays in the cache while its remaining triangles are emitted, oldest first
+        fanning = -1;
+        int bestPriority = -1;
+        for (size_t c = 0; c < candidates.size(); c++)
+        {
+            unsigned int v = candidates[c];
+            if (live[v] == 0)
+                continue;
+            int priority = 0;
+            if (time - cacheTime[v] + 2 * live[v] <= cacheSize)
+                priority = (int)(time - cacheTime[v]);
+            if (priority > bestPriority)
+            {
+                bestPriority = priority;
+                fanning = v;
+            }
+        }
+        if (fanning >= 0)
+            continue;
+        // dead end: a recently used vertex with triangles left, else the next one in input order
+        while (!deadEnd.empty() && fanning < 0)
+        {
+            unsigned int v = deadEnd.back();
+            deadEnd.pop_back();
+            if (live[v] > 0)
+                fanning = v;
+        }
+        while (fanning < 0 && cursor < vertexCount)
+        {
+            if (live[cursor] > 0)
+                fanning = (long long)cursor;
+            cursor++;
+        }
+    }
+    // keep a trailing partial triangle, if any, as it was
+    result.insert(result.end(), indices.begin() + triangleCount * 3, indices.end());
+    indices.swap(result);
+}
+
+// renumbers the vertices in the order the indices first use them, so vertex fetches walk the buffer forward.
+// vertices no triangle uses are dropped
+void optimizeVertexFetch(vector<Vertex> &vertices, vector<unsigned int> &indices)
+{
+    const unsigned int UNUSED = ~0u;
+    vector<unsigned int> remap(vertices.size(), UNUSED);
+    vector<Vertex> ordered;
+    ordered.reserve(vertices.size());
+    for (size_t i = 0; i < indices.size(); i++)
+    {
+        unsigned int &target = remap[indices[i]];
+        if (target == UNUSED)
+        {
+            target = (unsigned int)ordered.size();
+            ordered.push_back(vertices[indices[i]]);
+        }
+        indices[i] = target;
+    }
+    vertices.swap(ordered);
+}
+
+// splits a mesh into parts of at most maxVertices vertices, e.g. to draw it with 16-bit indices. the triangles keep
+// their order, which after optimizeVertexFetch also keeps each part's vertices mostly contiguous
+void splitMesh(const vector<Vertex> &vertices, const vector<unsigned int> &indices, size_t maxVertices,
+               vector<vector<Vertex> > &partVertices, vector<vector<unsigned int> > &partIndices)
+{
+    const unsigned int UNUSED = ~0u;
+    vector<unsigned int> remap(vertices.size(), UNUSED);
+    vector<unsigned int> used; // vertices of the current part, to reset remap
+    for (size_t t = 0; t + 2 < indices.size(); t += 3)
+    {
+        size_t added = 0;
+        for (int k = 0; k < 3; k++)
+            if (remap[indices[t + k]] == UNUSED)
+                added++;
+        if (partVertices.empty() || partVertices.back().size() + added > maxVertices)
+        {
+            for (size_t i = 0; i < used.size(); i++)
+                remap[used[i]] = UNUSED;
+            used.clear();
+            partVertices.push_back(vector<Vertex>());
+            partIndices.push_back(vector<unsigned int>());
+        }
+        for (int k = 0; k < 3; k++)
+        {
+            unsigned int &target = remap[indices[t + k]];
+            if (target == UNUSED)
+            {
+                target = (unsigned int)partVertices.back().size();
+                partVertices.back().push_back(vertices[indices[t + k]]);
+                used.push_back(indices[t + k]);
+            }
+            partIndices.back().push_back(target);
+        }
+    }
+}
+
+// runs all stages on one mesh
+void optimizeMesh(vector<Vertex> &vertices, vector<unsigned int> &indices, MeshOptimizeStats &stats)
+{
+    stats.triangles += indices.size() / 3;
+    stats.verticesBefore += vertices.size();
+    stats.missesBefore += countCacheMisses(indices, vertices.size());
+
+    weldVertices(vertices, indices);
+    // exporters sometimes already emit a good order, keep it when Tipsify doesn't beat it
+    vector<unsigned int> reordered(indices);
+    optimizeVertexCache(reordered, vertices.size());
+    if (countCacheMisses(reordered, vertices.size()) < countCacheMisses(indices, vertices.size()))
+        indices.swap(reordered);
+    optimizeVertexFetch(vertices, indices);
+
+    stats.verticesAfter += vertices.size();
+    stats.missesAfter += countCacheMisses(indices, vertices.size());
+}
+
+#endif /* mesh_optimizer_h */
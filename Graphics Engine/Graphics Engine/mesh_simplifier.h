@@ -0,0 +1,336 @@
+//
+//  mesh_simplifier.h
+//  Graphics Engine
+//
+//  Copyright © 2017 Tony. All rights reserved.
+//
+
+#ifndef mesh_simplifier_h
+#define mesh_simplifier_h
+
+#include <glm/glm.hpp>
+
+#include "mapped_file.h"
+#include "mesh.h"
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// Load-time LOD generation with the quadric error metric (Garland and Heckbert 1997). Vertices are only ever collapsed
+// onto a neighbor, so every level indexes the mesh's own vertex buffer and costs nothing but its indices. Vertices on
+// open borders and attribute seams (several vertices at one position) never move, which keeps silhouettes and
+// texture charts intact. Doesn't touch GL, meant to run on the loader threads.
+
+const unsigned int MESH_LOD_LEVELS = 4;         // the full mesh included
+const float MESH_LOD_REDUCTION = 0.5f;          // triangles each level aims to keep of the previous one
+const float MESH_LOD_MIN_REDUCTION = 0.8f;      // a level keeping more than this is not worth having
+const size_t MESH_LOD_MIN_TRIANGLES = 64;       // meshes this small aren't simplified further
+
+// sum of squared distances to a set of planes, each weighted by the area of the triangle it came from
+struct Quadric {
+    double xx, xy, xz, xw, yy, yz, yw, zz, zw, ww;
+    double weight;
+
+    Quadric() : xx(0), xy(0), xz(0), xw(0), yy(0), yz(0), yw(0), zz(0), zw(0), ww(0), weight(0) {}
+
+    // plane n.p + d = 0, n of unit length
+    Quadric(double nx, double ny, double nz, double d, double area)
+        : xx(area * nx * nx), xy(area * nx * ny), xz(area * nx * nz), xw(area * nx * d),
+          yy(area * ny * ny), yz(area * ny * nz), yw(area * ny * d),
+          zz(area * nz * nz), zw(area * nz * d), ww(area * d * d), weight(area) {}
+
+    void add(const Quadric &q)
+    {
+        xx += q.xx; xy += q.xy; xz += q.xz; xw += q.xw;
+        yy += q.yy; yz += q.yz; yw += q.yw;
+        zz += q.zz; zw += q.zw; ww += q.ww;
+        weight += q.weight;
+    }
+
+    // mean squared distance of a point to the planes
+    double error(const glm::vec3 &p) const
+    {
+        double x = p.x, y = p.y, z = p.z;
+        double sum = xx * x * x + yy * y * y + zz * z * z + ww
+                   + 2.0 * (xy * x * y + xz * x * z + yz * y * z + xw * x + yw * y + zw * z);
+        return weight > 0.0 ? std::max(0.0, sum / weight) : 0.0;
+    }
+};
+
+class MeshSimplifier
+{
+public:
+    // appends the coarser levels of an optimized mesh to its indices and describes every level, the full mesh first,
+    // in `lods`. each level halves the triangles of the previous one until the mesh can't be reduced any further
+    static void buildLodChain(const vector<Vertex> &vertices, vector<unsigned int> &indices, vector<MeshLod> &lods)
+    {
+        lods.clear();
+        MeshLod full = { 0, (uint32_t)indices.size(), 0.0f };
+        lods.push_back(full);
+        if (indices.size() / 3 < MESH_LOD_MIN_TRIANGLES)
+            return;
+
+        MeshSimplifier simplifier(vertices, indices);
+        size_t previous = simplifier.triangles.size() / 3;
+        while (lods.size() < MESH_LOD_LEVELS && previous >= MESH_LOD_MIN_TRIANGLES)
+        {
+            size_t target = (size_t)(previous * MESH_LOD_REDUCTION);
+            while (simplifier.triangles.size() / 3 > target)
+                if (!simplifier.collapsePass(simplifier.triangles.size() / 3 - target))
+                    break;
+            size_t reached = simplifier.triangles.size() / 3;
+            if (reached > previous * MESH_LOD_MIN_REDUCTION)
+                break;
+
+            vector<unsigned int> level(simplifier.triangles);
+            optimizeVertexCache(level, vertices.size());
+            MeshLod lod = { (uint32_t)indices.size(), (uint32_t)level.size(), simplifier.error };
+            indices.insert(indices.end(), level.begin(), level.end());
+            lods.push_back(lod);
+            previous = reached;
+        }
+    }
+
+private:
+    // a vertex moving onto a neighbor
+    struct Collapse {
+        unsigned int from, to;
+        double cost;
+
+        bool operator<(const Collapse &other) const { return cost < other.cost; }
+    };
+
+    const vector<Vertex> &vertices;
+    vector<unsigned int> triangles;     // the current level
+    vector<unsigned int> positionOf;    // per vertex the first vertex at the same position, which stands for all of them
+    vector<unsigned char> locked;       // per position, seams and borders
+    vector<Quadric> quadrics;           // per position
+    float error;                        // largest collapse error so far, as a distance
+
+    MeshSimplifier(const vector<Vertex> &vertices, const vector<unsigned int> &indices)
+        : vertices(vertices), triangles(indices.begin(), indices.begin() + indices.size() / 3 * 3),
+          positionOf(vertices.size()), locked(vertices.size(), 0), quadrics(vertices.size()), error(0.0f)
+    {
+        findPositions();
+        lockBorders();
+        for (size_t t = 0; t < triangles.size(); t += 3)
+        {
+            const glm::vec3 &p0 = vertices[triangles[t]].Position;
+            glm::vec3 normal = glm::cross(vertices[triangles[t + 1]].Position - p0, vertices[triangles[t + 2]].Position - p0);
+            double length = std::sqrt((double)glm::dot(normal, normal));
+            if (length == 0.0)
+                continue;
+            double nx = normal.x / length, ny = normal.y / length, nz = normal.z / length;
+            Quadric plane(nx, ny, nz, -(nx * p0.x + ny * p0.y + nz * p0.z), length * 0.5);
+            for (int k = 0; k < 3; k++)
+                quadrics[positionOf[triangles[t + k]]].add(plane);
+        }
+    }
+
+    // groups vertices by position, positions with more than one vertex lie on a seam
+    void findPositions()
+    {
+        size_t tableSize = 1;
+        while (tableSize < vertices.size() * 2)
+            tableSize *= 2;
+        const unsigned int EMPTY = ~0u;
+        vector<unsigned int> table(tableSize, EMPTY);
+        for (size_t i = 0; i < vertices.size(); i++)
+        {
+            const glm::vec3 &position = vertices[i].Position;
+            size_t slot = (size_t)hashBytes(&position, sizeof(glm::vec3)) & (tableSize - 1);
+            while (table[slot] != EMPTY && memcmp(&vertices[table[slot]].Position, &position, sizeof(glm::vec3)) != 0)
+                slot = (slot + 1) & (tableSize - 1);
+            if (table[slot] == EMPTY)
+                table[slot] = (unsigned int)i;
+            positionOf[i] = table[slot];
+            if (positionOf[i] != i)
+                locked[positionOf[i]] = 1;
+        }
+    }
+
+    // edges used by one triangle are on an open border, by more than two on a non-manifold junction
+    void lockBorders()
+    {
+        unordered_map<uint64_t, unsigned int> edgeUses;
+        edgeUses.reserve(triangles.size());
+        for (size_t t = 0; t < triangles.size(); t += 3)
+            for (int k = 0; k < 3; k++)
+                edgeUses[edgeKey(positionOf[triangles[t + k]], positionOf[triangles[t + (k + 1) % 3]])]++;
+        for (unordered_map<uint64_t, unsigned int>::const_iterator it = edgeUses.begin(); it != edgeUses.end(); ++it)
+        {
+            if (it->second == 2)
+                continue;
+            locked[(unsigned int)(it->first >> 32)] = 1;
+            locked[(unsigned int)it->first] = 1;
+        }
+    }
+
+    static uint64_t edgeKey(unsigned int a, unsigned int b)
+    {
+        return a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+    }
+
+    // one round of collapses, cheapest first, touching every position at most once.
+    // returns false when nothing could be collapsed
+    bool collapsePass(size_t trianglesToRemove)
+    {
+        size_t triangleCount = triangles.size() / 3;
+
+        // triangles around each position
+        vector<unsigned int> offsets(vertices.size() + 1, 0);
+        for (size_t i = 0; i < triangles.size(); i++)
+            offsets[positionOf[triangles[i]] + 1]++;
+        for (size_t v = 0; v < vertices.size(); v++)
+            offsets[v + 1] += offsets[v];
+        vector<unsigned int> adjacency(offsets[vertices.size()]);
+        vector<unsigned int> filled(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < triangles.size(); i++)
+            adjacency[filled[positionOf[triangles[i]]]++] = (unsigned int)(i / 3);
+
+        vector<Collapse> collapses;
+        collapses.reserve(triangles.size() * 2);
+        for (size_t t = 0; t < triangleCount; t++)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int a = triangles[t * 3 + k], b = triangles[t * 3 + (k + 1) % 3];
+                unsigned int pa = positionOf[a], pb = positionOf[b];
+                if (pa == pb)
+                    continue;
+                Quadric combined = quadrics[pa];
+                combined.add(quadrics[pb]);
+                if (!locked[pa])
+                {
+                    Collapse collapse = { a, b, combined.error(vertices[b].Position) };
+                    collapses.push_back(collapse);
+                }
+                if (!locked[pb])
+                {
+                    Collapse collapse = { b, a, combined.error(vertices[a].Position) };
+                    collapses.push_back(collapse);
+                }
+            }
+        }
+        std::sort(collapses.begin(), collapses.end());
+
+        vector<unsigned char> moved(vertices.size(), 0);
+        vector<unsigned char> removed(triangleCount, 0);
+        size_t removedCount = 0;
+        for (size_t c = 0; c < collapses.size() && removedCount < trianglesToRemove; c++)
+        {
+            const Collapse &collapse = collapses[c];
+            unsigned int pa = positionOf[collapse.from], pb = positionOf[collapse.to];
+            if (moved[pa] || moved[pb])
+                continue;
+            if (!canCollapse(collapse, adjacency, offsets, removed))
+                continue;
+
+            for (unsigned int i = offsets[pa]; i < offsets[pa + 1]; i++)
+            {
+                unsigned int t = adjacency[i];
+                if (removed[t])
+                    continue;
+                if (cornerAt(t, pb) >= 0)
+                {
+                    removed[t] = 1;
+                    removedCount++;
+                    continue;
+                }
+                for (int k = 0; k < 3; k++)
+                    if (positionOf[triangles[t * 3 + k]] == pa)
+                        triangles[t * 3 + k] = collapse.to;
+            }
+            quadrics[pb].add(quadrics[pa]);
+            moved[pa] = moved[pb] = 1;
+            error = std::max(error, (float)std::sqrt(collapse.cost));
+        }
+        if (removedCount == 0)
+            return false;
+
+        size_t kept = 0;
+        for (size_t t = 0; t < triangleCount; t++)
+        {
+            if (removed[t])
+                continue;
+            for (int k = 0; k < 3; k++)
+                triangles[kept * 3 + k] = triangles[t * 3 + k];
+            kept++;
+        }
+        triangles.resize(kept * 3);
+        return true;
+    }
+
+    // corner of a triangle at a position, -1 if none
+    int cornerAt(unsigned int t, unsigned int position) const
+    {
+        for (int k = 0; k < 3; k++)
+            if (positionOf[triangles[t * 3 + k]] == position)
+                return k;
+        return -1;
+    }
+
+    // a collapse must keep the surface manifold, not flip any triangle and, where the two triangles at the edge
+    // go away, reference the target vertex itself so no texture coordinates get mixed across a seam
+    bool canCollapse(const Collapse &collapse, const vector<unsigned int> &adjacency, const vector<unsigned int> &offsets,
+                     const vector<unsigned char> &removed) const
+    {
+        unsigned int pa = positionOf[collapse.from], pb = positionOf[collapse.to];
+        const glm::vec3 &target = vertices[collapse.to].Position;
+        vector<unsigned int> neighborsA, opposite;
+        for (unsigned int i = offsets[pa]; i < offsets[pa + 1]; i++)
+        {
+            unsigned int t = adjacency[i];
+            if (removed[t])
+                continue;
+            int corner = cornerAt(t, pa);
+            int cornerB = cornerAt(t, pb);
+            unsigned int next = positionOf[triangles[t * 3 + (corner + 1) % 3]];
+            unsigned int previous = positionOf[triangles[t * 3 + (corner + 2) % 3]];
+            if (cornerB >= 0)
+            {
+                if (triangles[t * 3 + cornerB] != collapse.to)
+                    return false;
+                opposite.push_back(next == pb ? previous : next);
+                continue;
+            }
+            neighborsA.push_back(next);
+            neighborsA.push_back(previous);
+
+            glm::vec3 p[3];
+            for (int k = 0; k < 3; k++)
+                p[k] = vertices[triangles[t * 3 + k]].Position;
+            glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+            p[corner] = target;
+            glm::vec3 after = glm::cross(p[1] - p[0], p[2] - p[0]);
+            if (glm::dot(before, after) <= 0.0f)
+                return false;
+        }
+
+        // link condition: the only neighbors both ends share are the corners opposite the edge
+        for (unsigned int i = offsets[pb]; i < offsets[pb + 1]; i++)
+        {
+            unsigned int t = adjacency[i];
+            if (removed[t])
+                continue;
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int p = positionOf[triangles[t * 3 + k]];
+                if (p == pa || p == pb)
+                    continue;
+                if (std::find(neighborsA.begin(), neighborsA.end(), p) != neighborsA.end()
+                    && std::find(opposite.begin(), opposite.end(), p) == opposite.end())
+                    return false;
+            }
+        }
+        return true;
+    }
+};
+
+#endif /* mesh_simplifier_h */
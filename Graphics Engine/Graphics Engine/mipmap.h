@@ -0,0 +1,338 @@
+//
+//  mipmap.h
+//  Graphics Engine
+//
+//  Copyright © 2017 Tony. All rights reserved.
+//
+
+#ifndef mipmap_h
+#define mipmap_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+using namespace std;
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Filter that shrinks one mip level into the next.
+enum MipFilter {
+    MIP_FILTER_BOX,   // average of the texels a mip texel covers
+    MIP_FILTER_KAISER // Kaiser windowed sinc: keeps detail sharper than the box and aliases less
+};
+
+struct MipLevel {
+    int width, height;
+    size_t offset; // into TextureImage::pixels
+};
+
+// An 8 bit per channel image with its full mip chain, level 0 first, stored back to back. The levels are either
+// pixels or, with a compressed `format`, rows of 4x4 blocks of `blockBytes` each (see texture_compression.h).
+struct TextureImage {
+    int width, height, components;
+    unsigned int format; // GL internal format of the blocks, 0 for pixels
+    int blockBytes;
+    vector<unsigned char> pixels;
+    vector<MipLevel> levels;
+
+    TextureImage() : width(0), height(0), components(0), format(0), blockBytes(0) {}
+
+    const unsigned char* level(size_t i) const
+    {
+        return &pixels[levels[i].offset];
+    }
+
+    // rows of a level: pixel rows, or block rows when compressed
+    int rowCount(size_t i) const
+    {
+        return format ? (levels[i].height + 3) / 4 : levels[i].height;
+    }
+
+    size_t rowBytes(size_t i) const
+    {
+        return format ? (size_t)((levels[i].width + 3) / 4) * blockBytes : (size_t)levels[i].width * components;
+    }
+
+    // height in pixels of `rows` rows starting at row `row`, the last block row may be cut off by the level's edge
+    int rowHeight(size_t i, int row, int rows) const
+    {
+        return format ? std::min(rows * 4, levels[i].height - row * 4) : rows;
+    }
+
+    size_t levelSize(size_t i) const
+    {
+        return rowCount(i) * rowBytes(i);
+    }
+};
+
+// Builds mip levels in floating point, every channel of a texel in one 4-float group so a texel is one SSE
+// register. Levels are resampled separably: horizontally texel by texel, then vertically as weighted sums of whole
+// rows, 8 floats at a time with AVX, 4 with SSE, scalar otherwise. Each level is made from the previous level's
+// floats, so rounding to 8 bits doesn't accumulate down the chain.
+namespace MipGenerator {
+
+    const float KAISER_ALPHA = 4.0f;
+    const float KAISER_RADIUS = 1.5f; // in texels of the smaller level
+
+    // sRGB <-> linear conversion tables
+    struct GammaTables {
+        static const int LINEAR_STEPS = 16384;
+        float toLinear[256];
+        float toFloat[256]; // no conversion, just to 0..1
+        unsigned char toSRGB[LINEAR_STEPS + 1];
+
+        GammaTables()
+        {
+            for (int i = 0; i < 256; i++)
+            {
+                float v = i / 255.0f;
+                toLinear[i] = v <= 0.04045f ? v / 12.92f : std::pow((v + 0.055f) / 1.055f, 2.4f);
+                toFloat[i] = v;
+            }
+            for (int i = 0; i <= LINEAR_STEPS; i++)
+            {
+                float v = (float)i / LINEAR_STEPS;
+                float encoded = v <= 0.0031308f ? v * 12.92f : 1.055f * std::pow(v, 1.0f / 2.4f) - 0.055f;
+                toSRGB[i] = (unsigned char)(encoded * 255.0f + 0.5f);
+            }
+        }
+    };
+
+    inline const GammaTables& gammaTables()
+    {
+        static GammaTables tables;
+        return tables;
+    }
+
+    // whether a channel holds gamma encoded color, alpha (the last channel of 2 and 4 channel images) never does
+    inline bool isColorChannel(int channel, int components)
+    {
+        return !((components == 4 && channel == 3) || (components == 2 && channel == 1));
+    }
+
+    inline float besselI0(float x)
+    {
+        float sum = 1.0f, term = 1.0f;
+        for (int k = 1; k < 16; k++)
+        {
+            term *= (x / (2.0f * k)) * (x / (2.0f * k));
+            sum += term;
+        }
+        return sum;
+    }
+
+    // filter weight at distance t, in texels of the smaller level
+    inline float kaiser(float t)
+    {
+        if (std::fabs(t) >= KAISER_RADIUS)
+            return 0.0f;
+        float sinc = t == 0.0f ? 1.0f : std::sin(3.14159265f * t) / (3.14159265f * t);
+        float r = t / KAISER_RADIUS;
+        return sinc * besselI0(KAISER_ALPHA * std::sqrt(1.0f - r * r)) / besselI0(KAISER_ALPHA);
+    }
+
+    // the source texels and weights of every destination texel along one axis, `taps` per texel
+    struct Kernel {
+        int taps;
+        vector<int> sources;
+        vector<float> weights;
+    };
+
+    inline void buildKernel(int sourceSize, int size, MipFilter filter, Kernel &kernel)
+    {
+        float scale = (float)sourceSize / size;
+        float radius = filter == MIP_FILTER_BOX ? 0.5f * scale : KAISER_RADIUS * scale; // in source texels
+        kernel.taps = sourceSize == size ? 1 : (int)std::ceil(2.0f * radius) + 1;
+        kernel.sources.assign((size_t)size * kernel.taps, 0);
+        kernel.weights.assign((size_t)size * kernel.taps, 0.0f);
+        for (int x = 0; x < size; x++)
+        {
+            int* sources = &kernel.sources[(size_t)x * kernel.taps];
+            float* weights = &kernel.weights[(size_t)x * kernel.taps];
+            if (sourceSize == size)
+            {
+                sources[0] = x;
+                weights[0] = 1.0f;
+                continue;
+            }
+            float center = (x + 0.5f) * scale; // in source texels
+            int first = (int)std::floor(center - radius);
+            float sum = 0.0f;
+            for (int k = 0; k < kernel.taps; k++)
+            {
+                int source = first + k;
+                float weight;
+                if (filter == MIP_FILTER_BOX)
+                {
+                    // how much of the source texel the footprint covers
+                    weight = std::max(0.0f, std::min((float)source + 1.0f, center + radius) - std::max((float)source, center - radius));
+                }
+                else
+                    weight = kaiser((source + 0.5f - center) / scale);
+                sources[k] = std::min(std::max(source, 0), sourceSize - 1); // clamp to the edge
+                weights[k] = weight;
+                sum += weight;
+            }
+            for (int k = 0; k < kernel.taps; k++)
+                weights[k] /= sum;
+        }
+    }
+
+    // source (sourceWidth x height texels) -> destination (width x height)
+    inline void resampleRows(const float* source, int sourceWidth, int height, const Kernel &kernel, int width, float* destination)
+    {
+        for (int y = 0; y < height; y++)
+        {
+            const float* row = source + (size_t)y * sourceWidth * 4;
+            float* out = destination + (size_t)y * width * 4;
+            for (int x = 0; x < width; x++)
+            {
+                const int* sources = &kernel.sources[(size_t)x * kernel.taps];
+                const float* weights = &kernel.weights[(size_t)x * kernel.taps];
+#if defined(__SSE2__) || defined(__AVX__)
+                __m128 sum = _mm_setzero_ps();
+                for (int k = 0; k < kernel.taps; k++)
+                    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(row + sources[k] * 4)));
+                _mm_storeu_ps(out + x * 4, sum);
+#else
+                float sum[4] = {};
+                for (int k = 0; k < kernel.taps; k++)
+                    for (int c = 0; c < 4; c++)
+                        sum[c] += weights[k] * row[sources[k] * 4 + c];
+                memcpy(out + x * 4, sum, sizeof(sum));
+#endif
+            }
+        }
+    }
+
+    // source (width x sourceHeight texels) -> destination (width x height)
+    inline void resampleColumns(const float* source, int width, const Kernel &kernel, int height, float* destination)
+    {
+        size_t floats = (size_t)width * 4;
+        for (int y = 0; y < height; y++)
+        {
+            const int* sources = &kernel.sources[(size_t)y * kernel.taps];
+            const float* weights = &kernel.weights[(size_t)y * kernel.taps];
+            float* out = destination + y * floats;
+            size_t i = 0;
+#if defined(__AVX__)
+            for (; i + 8 <= floats; i += 8)
+            {
+                __m256 sum = _mm256_setzero_ps();
+                for (int k = 0; k < kernel.taps; k++)
+                    sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(weights[k]), _mm256_loadu_ps(source + sources[k] * floats + i)));
+                _mm256_storeu_ps(out + i, sum);
+            }
+#endif
+#if defined(__SSE2__) || defined(__AVX__)
+            for (; i + 4 <= floats; i += 4)
+            {
+                __m128 sum = _mm_setzero_ps();
+                for (int k = 0; k < kernel.taps; k++)
+                    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(source + sources[k] * floats + i)));
+                _mm_storeu_ps(out + i, sum);
+            }
+#endif
+            for (; i < floats; i++)
+            {
+                float sum = 0.0f;
+                for (int k = 0; k < kernel.taps; k++)
+                    sum += weights[k] * source[sources[k] * floats + i];
+                out[i] = sum;
+            }
+        }
+    }
+
+    // 8 bit texels -> 4 floats per texel, linear light if `gammaCorrect`
+    inline void toFloat(const unsigned char* pixels, size_t count, int components, bool gammaCorrect, float* texels)
+    {
+        const GammaTables &tables = gammaTables();
+        const float* table[4];
+        for (int c = 0; c < components; c++)
+            table[c] = gammaCorrect && isColorChannel(c, components) ? tables.toLinear : tables.toFloat;
+        for (size_t i = 0; i < count; i++)
+        {
+            float* texel = texels + i * 4;
+            texel[0] = texel[1] = texel[2] = 0.0f;
+            texel[3] = 1.0f;
+            for (int c = 0; c < components; c++)
+                texel[c] = table[c][pixels[i * components + c]];
+        }
+    }
+
+    // the reverse, clamping what the filter's negative lobes overshot
+    inline void toBytes(float* texels, size_t count, int components, bool gammaCorrect, unsigned char* pixels)
+    {
+        const GammaTables &tables = gammaTables();
+        size_t i = 0;
+#if defined(__SSE2__) || defined(__AVX__)
+        for (; i < count; i++)
+            _mm_storeu_ps(texels + i * 4, _mm_min_ps(_mm_max_ps(_mm_loadu_ps(texels + i * 4), _mm_setzero_ps()), _mm_set1_ps(1.0f)));
+#else
+        for (; i < count * 4; i++)
+            texels[i] = std::min(std::max(texels[i], 0.0f), 1.0f);
+#endif
+        for (int c = 0; c < components; c++)
+        {
+            if (gammaCorrect && isColorChannel(c, components))
+            {
+                for (i = 0; i < count; i++)
+                    pixels[i * components + c] = tables.toSRGB[(int)(texels[i * 4 + c] * GammaTables::LINEAR_STEPS + 0.5f)];
+            }
+            else
+            {
+                for (i = 0; i < count; i++)
+                    pixels[i * components + c] = (unsigned char)(texels[i * 4 + c] * 255.0f + 0.5f);
+            }
+        }
+    }
+}
+
+// builds a TextureImage with all mip levels down to 1x1 from a decoded image. With `gammaCorrect` the color
+// channels are treated as sRGB and filtered in linear light, so mips keep the image's brightness
+void buildMipChain(const unsigned char* pixels, int width, int height, int components, TextureImage &image,
+                   MipFilter filter = MIP_FILTER_BOX, bool gammaCorrect = false)
+{
+    image.width = width;
+    image.height = height;
+    image.components = components;
+    image.format = 0;
+    image.blockBytes = 0;
+    image.levels.clear();
+    size_t total = 0;
+    for (int w = width, h = height; ; w = std::max(1, w / 2), h = std::max(1, h / 2))
+    {
+        MipLevel level = { w, h, total };
+        image.levels.push_back(level);
+        total += (size_t)w * h * components;
+        if (w == 1 && h == 1)
+            break;
+    }
+    image.pixels.resize(total);
+    memcpy(&image.pixels[0], pixels, image.levelSize(0));
+    if (image.levels.size() == 1)
+        return;
+
+    vector<float> current((size_t)width * height * 4), rows, next;
+    MipGenerator::toFloat(pixels, (size_t)width * height, components, gammaCorrect, &current[0]);
+    MipGenerator::Kernel horizontal, vertical;
+    for (size_t i = 1; i < image.levels.size(); i++)
+    {
+        const MipLevel &source = image.levels[i - 1], &level = image.levels[i];
+        MipGenerator::buildKernel(source.width, level.width, filter, horizontal);
+        MipGenerator::buildKernel(source.height, level.height, filter, vertical);
+        rows.resize((size_t)level.width * source.height * 4);
+        next.resize((size_t)level.width * level.height * 4);
+        MipGenerator::resampleRows(&current[0], source.width, source.height, horizontal, level.width, &rows[0]);
+        MipGenerator::resampleColumns(&rows[0], level.width, vertical, level.height, &next[0]);
+        MipGenerator::toBytes(&next[0], (size_t)level.width * level.height, components, gammaCorrect, &image.pixels[level.offset]);
+        current.swap(next);
+    }
+}
+
+#endif /* mipmap_h */
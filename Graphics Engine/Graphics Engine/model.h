@@ -19,7 +19,14 @@
 #include <assimp/postprocess.h>
 
 #include "mesh.h"
+#include "mesh_cache.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+#include "obj_loader.h"
+#include "thread_pool.h"
+#include "texture_registry.h"
 #include "shader.h"
+#include "load_stats.h"
 
 #include <string>
 #include <fstream>
@@ -29,125 +36,336 @@
 #include <vector>
 using namespace std;
 
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false);
+unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false, bool packed = false);
+
+// post processing applied to every imported model, part of the mesh cache key
+const unsigned int MODEL_IMPORT_FLAGS = aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace;
 
 class Model
 {
 public:
     /*  Model Data */
-    vector<Texture> textures_loaded;    // stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
+    vector<Texture> textures_loaded;    // every texture reference the model took from the TextureRegistry, given back in Delete()
     vector<Mesh> meshes;
     string directory;
     bool gammaCorrection;
+    unsigned int vertexAttributes; // ATTRIBUTE_* the shader drawing the model reads, see shaderVertexAttributes()
     
     /*  Functions   */
-    // constructor, expects a filepath to a 3D model.
-    Model(string const &path, bool gamma = false) : gammaCorrection(gamma)
+    // constructor, expects a filepath to a 3D model. the meshes' vertex buffers only hold the vertex attributes
+    // the drawing shader reads
+    Model(string const &path, bool gamma = false, unsigned int vertexAttributes = ATTRIBUTES_ALL) : gammaCorrection(gamma), vertexAttributes(vertexAttributes)
     {
         loadModel(path);
     }
     
-    // draws the model, and thus all its meshes
-    void Draw(Shader shader)
+    // draws the model, and thus all its meshes. textures in `overrides` replace the model's textures of the same type
+    void Draw(const Shader &shader, const vector<Texture> &overrides = vector<Texture>()) const
+    {
+        Draw(shader, glm::mat4(1.0f), LodSelector(), overrides);
+    }
+    
+    // draws every mesh at the level of detail `lod` picks for it, placed with `transform`
+    // (meshes sharing a vertex arena or a material texture array draw without rebinding them)
+    void Draw(const Shader &shader, const glm::mat4 &transform, const LodSelector &lod, const vector<Texture> &overrides = vector<Texture>()) const
+    {
+        for(unsigned int i = 0; i < meshes.size(); i++)
+            meshes[i].Draw(shader, overrides, lod.select(meshes[i], transform));
+    }
+    
+    // draws all meshes for a shader that only reads positions, e.g. a depth pass. pick the levels of detail with the
+    // same selector as the pass drawn on top, or the depths won't match
+    void DrawPositions(const Shader &shader, const glm::mat4 &transform = glm::mat4(1.0f), const LodSelector &lod = LodSelector()) const
     {
         for(unsigned int i = 0; i < meshes.size(); i++)
-            meshes[i].Draw(shader);
+            meshes[i].DrawPositions(shader, lod.select(meshes[i], transform));
+    }
+    
+    // frees all GPU resources of the model
+    void Delete()
+    {
+        for(unsigned int i = 0; i < meshes.size(); i++)
+            meshes[i].Delete();
+        for(unsigned int i = 0; i < textures_loaded.size(); i++)
+            TextureRegistry::instance().release(textures_loaded[i].id);
+        meshes.clear();
+        textures_loaded.clear();
     }
     
 private:
     /*  Functions   */
     // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
+    // the processed meshes are cached next to the model file, later loads of an unchanged file map the cache instead.
     void loadModel(string const &path)
     {
+        // retrieve the directory path of the filepath
+        directory = path.substr(0, path.find_last_of('/'));
+        
+        // try the mesh cache first
+        MeshCacheKey cacheKey;
+        bool cacheable = cacheKey.read(path, MODEL_IMPORT_FLAGS, vertexAttributes, meshVertexFormat(), meshPositionStreams());
+        if(cacheable)
+        {
+            MeshCache cache;
+            if(!ignoreLoadCaches() && cache.open(MeshCache::pathFor(path, cacheKey), cacheKey))
+            {
+                loadCachedMeshes(cache);
+                return;
+            }
+        }
+        
+        // OBJ files are parsed directly, Assimp only handles the other formats (or OBJs the parser can't read)
+        if(path.size() > 4 && path.compare(path.size() - 4, 4, ".obj") == 0 && loadObj(path))
+        {
+            if(cacheable)
+                MeshCache::write(MeshCache::pathFor(path, cacheKey), cacheKey, meshes);
+            return;
+        }
+        
         // read file via ASSIMP
         Assimp::Importer importer;
-        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+        const aiScene* scene;
+        {
+            LoadTimer timer(modelLoadStats().importMs);
+            scene = importer.ReadFile(path, MODEL_IMPORT_FLAGS);
+        }
         // check for errors
         if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
         {
             cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
             return;
         }
-        // retrieve the directory path of the filepath
-        directory = path.substr(0, path.find_last_of('/'));
         
         // process ASSIMP's root node recursively
         processNode(scene->mRootNode, scene);
+        
+        if(cacheable)
+            MeshCache::write(MeshCache::pathFor(path, cacheKey), cacheKey, meshes);
+    }
+    
+    // creates the meshes straight from a mapped cache, without building intermediate vertex vectors
+    void loadCachedMeshes(const MeshCache &cache)
+    {
+        for(unsigned int i = 0; i < cache.meshCount(); i++)
+        {
+            vector<pair<string, string> > references = cache.textures(i);
+            vector<Texture> textures;
+            for(unsigned int j = 0; j < references.size(); j++)
+                addTexture(textures, references[j].second, references[j].first);
+            meshes.push_back(Mesh(cache.streams(i), textures, cache.entry(i).attributes, cache.lods(i)));
+        }
+    }
+    
+    // loads an OBJ file with ObjLoader, the tangents of each mesh are computed and the mesh prepared (see prepareMesh)
+    // on the thread pool
+    bool loadObj(string const &path)
+    {
+        ObjLoader loader;
+        bool loaded;
+        {
+            LoadTimer timer(modelLoadStats().importMs);
+            loaded = loader.load(path);
+        }
+        if(!loaded)
+            return false;
+        
+        ThreadPool &pool = ThreadPool::shared();
+        vector<std::future<MeshData> > conversions;
+        for(unsigned int i = 0; i < loader.meshes.size(); i++)
+        {
+            ObjMesh* mesh = &loader.meshes[i];
+            conversions.push_back(pool.enqueue([mesh]() {
+                MeshData data;
+                data.convertMs = 0.0;
+                {
+                    LoadTimer timer(data.convertMs);
+                    ObjLoader::computeTangents(*mesh);
+                    prepareMesh(mesh->vertices, mesh->indices, data);
+                }
+                return data;
+            }));
+        }
+        
+        meshes.reserve(meshes.size() + loader.meshes.size());
+        for(unsigned int i = 0; i < loader.meshes.size(); i++)
+        {
+            const ObjMesh &mesh = loader.meshes[i];
+            vector<Texture> textures;
+            for(unsigned int j = 0; j < mesh.textures.size(); j++)
+                addTexture(textures, mesh.textures[j].second, mesh.textures[j].first);
+            MeshData data = conversions[i].get();
+            modelLoadStats().convertMs += data.convertMs;
+            modelLoadStats().optimize.add(data.optimize);
+            addMeshes(data, textures);
+        }
+        return true;
+    }
+    
+    // the vertex attributes a mesh needs: what the shader reads, minus the tangents unless there is a normal map to use them
+    unsigned int meshAttributes(const vector<Texture> &textures) const
+    {
+        for(unsigned int i = 0; i < textures.size(); i++)
+            if(textures[i].type == "texture_normal")
+                return vertexAttributes;
+        return vertexAttributes & ~ATTRIBUTE_TANGENTS;
+    }
+    
+    // a mesh as it is handed to the GL, see prepareMesh
+    struct MeshPart {
+        vector<Vertex> vertices;
+        vector<unsigned int> indices;
+        vector<MeshLod> lods;
+    };
+    
+    // CPU-side result of converting one aiMesh
+    struct MeshData {
+        vector<MeshPart> parts; // one unless the mesh had too many vertices for 16-bit indices
+        double convertMs;
+        MeshOptimizeStats optimize;
+    };
+    
+    // optimizes converted vertices and faces, splits them into parts that 16-bit indices can address and builds the
+    // parts' levels of detail. runs on a worker thread
+    static void prepareMesh(vector<Vertex> &vertices, vector<unsigned int> &indices, MeshData &data)
+    {
+        optimizeMesh(vertices, indices, data.optimize);
+        if(vertices.size() <= SHORT_INDEX_VERTICES)
+        {
+            data.parts.resize(1);
+            data.parts[0].vertices = std::move(vertices);
+            data.parts[0].indices = std::move(indices);
+        }
+        else
+        {
+            vector<vector<Vertex> > partVertices;
+            vector<vector<unsigned int> > partIndices;
+            splitMesh(vertices, indices, SHORT_INDEX_VERTICES, partVertices, partIndices);
+            data.parts.resize(partVertices.size());
+            for(unsigned int i = 0; i < partVertices.size(); i++)
+            {
+                data.parts[i].vertices = std::move(partVertices[i]);
+                data.parts[i].indices = std::move(partIndices[i]);
+            }
+        }
+        for(unsigned int i = 0; i < data.parts.size(); i++)
+            MeshSimplifier::buildLodChain(data.parts[i].vertices, data.parts[i].indices, data.parts[i].lods);
     }
     
-    // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
+    // creates the meshes of a converted mesh's parts, which all use its textures
+    void addMeshes(MeshData &data, const vector<Texture> &textures)
+    {
+        unsigned int attributes = meshAttributes(textures);
+        for(unsigned int i = 0; i < data.parts.size(); i++)
+        {
+            MeshPart &part = data.parts[i];
+            meshes.push_back(Mesh(std::move(part.vertices), std::move(part.indices), textures, attributes, std::move(part.lods)));
+        }
+    }
+    
+    // converts all meshes of the node tree on the thread pool, then creates their GL buffers and loads their textures
+    // here on the context thread, in traversal order so the meshes vector stays deterministic.
     void processNode(aiNode *node, const aiScene *scene)
+    {
+        vector<aiMesh*> nodeMeshes;
+        collectMeshes(node, scene, nodeMeshes);
+        
+        ThreadPool &pool = ThreadPool::shared();
+        vector<std::future<MeshData> > conversions;
+        for(unsigned int i = 0; i < nodeMeshes.size(); i++)
+        {
+            const aiMesh* mesh = nodeMeshes[i];
+            conversions.push_back(pool.enqueue([mesh]() { return convertMesh(mesh); }));
+        }
+        
+        meshes.reserve(meshes.size() + nodeMeshes.size());
+        for(unsigned int i = 0; i < nodeMeshes.size(); i++)
+        {
+            // the textures of this mesh load while the workers are still converting the following meshes
+            vector<Texture> textures = processMaterial(nodeMeshes[i], scene);
+            MeshData data = conversions[i].get();
+            modelLoadStats().convertMs += data.convertMs;
+            modelLoadStats().optimize.add(data.optimize);
+            addMeshes(data, textures);
+        }
+    }
+    
+    // collects the meshes of a node and, recursively, of its children (if any).
+    void collectMeshes(aiNode *node, const aiScene *scene, vector<aiMesh*> &nodeMeshes)
     {
         // process each mesh located at the current node
         for(unsigned int i = 0; i < node->mNumMeshes; i++)
         {
             // the node object only contains indices to index the actual objects in the scene.
             // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
-            aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            meshes.push_back(processMesh(mesh, scene));
+            nodeMeshes.push_back(scene->mMeshes[node->mMeshes[i]]);
         }
         // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
         for(unsigned int i = 0; i < node->mNumChildren; i++)
         {
-            processNode(node->mChildren[i], scene);
+            collectMeshes(node->mChildren[i], scene, nodeMeshes);
         }
-        
     }
     
-    Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+    // converts the vertices and faces of a mesh and prepares it (see prepareMesh), runs on a worker thread so it must not touch GL or the model
+    static MeshData convertMesh(const aiMesh *mesh)
     {
-        // data to fill
-        vector<Vertex> vertices;
-        vector<unsigned int> indices;
-        vector<Texture> textures;
+        MeshData data;
+        data.convertMs = 0.0;
+        {
+            LoadTimer timer(data.convertMs);
+            vector<Vertex> vertices;
+            vector<unsigned int> indices;
         
-        // Walk through each of the mesh's vertices
-        for(unsigned int i = 0; i < mesh->mNumVertices; i++)
-        {
-            Vertex vertex;
-            glm::vec3 vector; // we declare a placeholder vector since assimp uses its own vector class that doesn't directly convert to glm's vec3 class so we transfer the data to this placeholder glm::vec3 first.
-            // positions
-            vector.x = mesh->mVertices[i].x;
-            vector.y = mesh->mVertices[i].y;
-            vector.z = mesh->mVertices[i].z;
-            vertex.Position = vector;
-            // normals
-            vector.x = mesh->mNormals[i].x;
-            vector.y = mesh->mNormals[i].y;
-            vector.z = mesh->mNormals[i].z;
-            vertex.Normal = vector;
-            // texture coordinates
-            if(mesh->mTextureCoords[0]) // does the mesh contain texture coordinates?
+            // Walk through each of the mesh's vertices
+            vertices.resize(mesh->mNumVertices);
+            for(unsigned int i = 0; i < mesh->mNumVertices; i++)
             {
-                glm::vec2 vec;
+                Vertex &vertex = vertices[i];
+                // positions
+                vertex.Position = glm::vec3(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
+                // normals
+                if(mesh->mNormals)
+                    vertex.Normal = glm::vec3(mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z);
+                else
+                    vertex.Normal = glm::vec3(0.0f, 0.0f, 0.0f);
+                // texture coordinates
                 // a vertex can contain up to 8 different texture coordinates. We thus make the assumption that we won't
                 // use models where a vertex can have multiple texture coordinates so we always take the first set (0).
-                vec.x = mesh->mTextureCoords[0][i].x;
-                vec.y = mesh->mTextureCoords[0][i].y;
-                vertex.TexCoords = vec;
+                if(mesh->mTextureCoords[0]) // does the mesh contain texture coordinates?
+                    vertex.TexCoords = glm::vec2(mesh->mTextureCoords[0][i].x, mesh->mTextureCoords[0][i].y);
+                else
+                    vertex.TexCoords = glm::vec2(0.0f, 0.0f);
+                // tangent and bitangent (only calculated for meshes with texture coordinates)
+                if(mesh->mTangents)
+                {
+                    vertex.Tangent = glm::vec3(mesh->mTangents[i].x, mesh->mTangents[i].y, mesh->mTangents[i].z);
+                    vertex.Bitangent = glm::vec3(mesh->mBitangents[i].x, mesh->mBitangents[i].y, mesh->mBitangents[i].z);
+                }
+                else
+                {
+                    vertex.Tangent = glm::vec3(0.0f, 0.0f, 0.0f);
+                    vertex.Bitangent = glm::vec3(0.0f, 0.0f, 0.0f);
+                }
             }
-            else
-                vertex.TexCoords = glm::vec2(0.0f, 0.0f);
-            // tangent
-            vector.x = mesh->mTangents[i].x;
-            vector.y = mesh->mTangents[i].y;
-            vector.z = mesh->mTangents[i].z;
-            vertex.Tangent = vector;
-            // bitangent
-            vector.x = mesh->mBitangents[i].x;
-            vector.y = mesh->mBitangents[i].y;
-            vector.z = mesh->mBitangents[i].z;
-            vertex.Bitangent = vector;
-            vertices.push_back(vertex);
-        }
-        // now wak through each of the mesh's faces (a face is a mesh its triangle) and retrieve the corresponding vertex indices.
-        for(unsigned int i = 0; i < mesh->mNumFaces; i++)
-        {
-            aiFace face = mesh->mFaces[i];
-            // retrieve all indices of the face and store them in the indices vector
-            for(unsigned int j = 0; j < face.mNumIndices; j++)
-                indices.push_back(face.mIndices[j]);
+            // now wak through each of the mesh's faces (a face is a mesh its triangle) and retrieve the corresponding vertex indices.
+            indices.reserve(mesh->mNumFaces * 3);
+            for(unsigned int i = 0; i < mesh->mNumFaces; i++)
+            {
+                const aiFace &face = mesh->mFaces[i];
+                // retrieve all indices of the face and store them in the indices vector
+                for(unsigned int j = 0; j < face.mNumIndices; j++)
+                    indices.push_back(face.mIndices[j]);
+            }
+            // Assimp leaves the faces unindexed (no aiProcess_JoinIdenticalVertices), welding happens here
+            prepareMesh(vertices, indices, data);
         }
+        return data;
+    }
+    
+    // loads the textures of a mesh's material
+    vector<Texture> processMaterial(aiMesh *mesh, const aiScene *scene)
+    {
+        vector<Texture> textures;
         // process materials
         aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
         // we assume a convention for sampler names in the shaders. Each diffuse texture should be named
@@ -170,8 +388,7 @@ private:
         std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
         textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
         
-        // return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices, textures);
+        return textures;
     }
     
     // checks all material textures of a given type and loads the textures if they're not loaded yet.
@@ -183,70 +400,41 @@ private:
         {
             aiString str;
             mat->GetTexture(type, i, &str);
-            // check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-            bool skip = false;
-            for(unsigned int j = 0; j < textures_loaded.size(); j++)
-            {
-                if(std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-                {
-                    textures.push_back(textures_loaded[j]);
-                    skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-                    break;
-                }
-            }
-            if(!skip)
-            {   // if texture hasn't been loaded already, load it
-                Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory);
-                texture.type = typeName;
-                texture.path = str.C_Str();
-                textures.push_back(texture);
-                textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
-            }
+            addTexture(textures, str.C_Str(), typeName);
         }
         return textures;
     }
+    
+    // loads a texture of a mesh and adds it to the mesh's `textures`, textures already loaded by this or any other
+    // model are shared (see TextureRegistry). the mesh's first diffuse texture is packed into a texture array, the
+    // only texture Mesh::Draw samples from one; the others stay plain 2D textures. only diffuse textures are color,
+    // specular, normal and height maps are data and aren't decoded as sRGB
+    void addTexture(vector<Texture> &textures, const string &path, const string &typeName)
+    {
+        bool packed = typeName == "texture_diffuse";
+        for(unsigned int i = 0; i < textures.size() && packed; i++)
+            packed = textures[i].type != "texture_diffuse";
+        Texture texture;
+        texture.id = TextureFromFile(path.c_str(), this->directory, typeName == "texture_diffuse", packed);
+        texture.type = typeName;
+        texture.path = path;
+        textures_loaded.push_back(texture);
+        textures.push_back(texture);
+    }
 };
 
 
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma)
+// takes a reference to a texture of a model, loaded asynchronously if it is new (see TextureRegistry and TextureLoader)
+unsigned int TextureFromFile(const char *path, const string &directory, bool gamma, bool packed)
 {
     string filename = string(path);
     filename = directory + '/' + filename;
     
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-    
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-    if (data)
-    {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-        
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-        
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        
-        stbi_image_free(data);
-    }
-    else
-    {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
-    }
-    
-    return textureID;
+    // packed textures share texture arrays with the textures of their size, so switching materials binds nothing
+    TextureOptions options;
+    options.srgb = gamma;
+    options.packed = packed;
+    return TextureRegistry::instance().acquire(filename, options);
 }
 
 #endif /* model_h */
@@ -0,0 +1,140 @@
+//
+//  model_benchmark.cpp
+//  Graphics Engine
+//
+//  Copyright © 2017 Tony. All rights reserved.
+//
+//  Standalone benchmark of the model loader: loads every .obj under the models directory repeatedly on a
+//  headless context and reports the time spent in Assimp import, vertex conversion, texture decode and GL upload.
+//  By default every timed load hits the mesh and texture caches (an untimed load fills them first); with --cold
+//  every load ignores and rebuilds them.
+//
+//  usage: model_benchmark [--cold] [iterations] [models directory]   (defaults: 10 ../models)
+//
+
+// include glad
+#include <glad/glad.h>
+
+// include our own files
+#include "headless.h"
+#include "model.h"
+
+// include C++ library
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+// collects all .obj files below a directory, sorted so runs are comparable
+void findModels(const string &directory, vector<string> &paths)
+{
+    DIR* dir = opendir(directory.c_str());
+    if (!dir)
+        return;
+    while (dirent* entry = readdir(dir))
+    {
+        string name = entry->d_name;
+        if (name == "." || name == "..")
+            continue;
+        string path = directory + '/' + name;
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0)
+            continue;
+        if (S_ISDIR(info.st_mode))
+            findModels(path, paths);
+        else if (name.size() > 4 && name.compare(name.size() - 4, 4, ".obj") == 0)
+            paths.push_back(path);
+    }
+    closedir(dir);
+    std::sort(paths.begin(), paths.end());
+}
+
+// min / median / p99 of a set of samples
+void printStage(const char* stage, vector<double> samples)
+{
+    std::sort(samples.begin(), samples.end());
+    size_t p99 = std::min(samples.size() - 1, samples.size() * 99 / 100);
+    printf("    %-8s min %9.2f  median %9.2f  p99 %9.2f ms\n", stage, samples.front(), samples[samples.size() / 2], samples[p99]);
+}
+
+int main(int argc, char** argv)
+{
+    bool cold = false;
+    vector<string> arguments;
+    for (int i = 1; i < argc; i++)
+    {
+        if (string(argv[i]) == "--cold")
+            cold = true;
+        else
+            arguments.push_back(argv[i]);
+    }
+    int iterations = arguments.size() > 0 ? std::max(1, atoi(arguments[0].c_str())) : 10;
+    string modelDirectory = arguments.size() > 1 ? arguments[1] : "../models";
+    ignoreLoadCaches() = cold;
+
+    HeadlessContext context;
+    if (!context.create(1, 1))
+        return -1;
+
+    vector<string> paths;
+    findModels(modelDirectory, paths);
+    if (paths.empty())
+    {
+        std::cout << "No .obj models found in " << modelDirectory << std::endl;
+        return -1;
+    }
+
+    for (size_t m = 0; m < paths.size(); m++)
+    {
+        vector<double> total, import, convert, decode, upload;
+        MeshOptimizeStats optimized;
+        if (!cold)
+        {
+            // fill the caches so every timed load is a warm one
+            modelLoadStats().reset();
+            Model model(paths[m]);
+            TextureLoader::instance().finish();
+            optimized = modelLoadStats().optimize;
+            model.Delete();
+        }
+        for (int i = 0; i < iterations; i++)
+        {
+            ModelLoadStats &stats = modelLoadStats();
+            stats.reset();
+            std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+            Model model(paths[m]);
+            TextureLoader::instance().finish();
+            {
+                // wait for the driver to finish the uploads so they are not billed to the next load
+                LoadTimer timer(stats.uploadMs);
+                glFinish();
+            }
+            total.push_back(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+            import.push_back(stats.importMs);
+            convert.push_back(stats.convertMs);
+            decode.push_back(stats.decodeMs);
+            upload.push_back(stats.uploadMs);
+            if (stats.optimize.triangles > 0)
+                optimized = stats.optimize; // only loads that missed the mesh cache optimize
+            model.Delete();
+        }
+
+        printf("%s (%d %s iterations)\n", paths[m].c_str(), iterations, cold ? "cold" : "warm");
+        printStage("total", total);
+        printStage("import", import);
+        printStage("convert", convert);
+        printStage("decode", decode);
+        printStage("upload", upload);
+        if (optimized.triangles > 0)
+            printf("    %zu -> %zu vertices, ACMR %.2f -> %.2f over %zu triangles\n", optimized.verticesBefore, optimized.verticesAfter, optimized.acmrBefore(), optimized.acmrAfter(), optimized.triangles);
+    }
+
+    context.destroy();
+    return 0;
+}
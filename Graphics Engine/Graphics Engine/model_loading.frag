@@ -4,8 +4,13 @@ out vec4 FragColor;
 in vec2 TexCoords;
 
 uniform sampler2D texture_diffuse1;
+uniform sampler2DArray materialArray; // diffuse textures packed by size (see TextureArrays)
+uniform int materialLayer;            // the mesh's layer of materialArray, -1 to sample texture_diffuse1
 
 void main()
 {
-    FragColor = texture(texture_diffuse1, TexCoords);
+    if (materialLayer >= 0)
+        FragColor = texture(materialArray, vec3(TexCoords, materialLayer));
+    else
+        FragColor = texture(texture_diffuse1, TexCoords);
 }
@@ -1,9 +1,23 @@
 #version 330 core
+#ifdef PACKED_VERTEX
+// VertexLayout<..., true>, see vertex_format.h: positions and UVs, the only attributes the shading reads
+layout (location = 0) in vec4 aPos;       // unorm16, relative to the mesh bounds
+layout (location = 2) in vec2 aTexCoords; // half float
+
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+
+vec3 position() { return positionOffset + aPos.xyz * positionScale; }
+#else
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
 
+vec3 position() { return aPos; }
+#endif
+
 out vec2 TexCoords;
+invariant gl_Position; // matches the depth pre-pass, see depth.vs
 
 uniform mat4 model;
 uniform mat4 view;
@@ -13,8 +27,8 @@ uniform vec4 plane;
 
 void main()
 {
-    vec4 worldPos = model * vec4(aPos, 1.0);
+    vec4 worldPos = model * vec4(position(), 1.0);
     gl_ClipDistance[0] = dot(worldPos, plane);
     TexCoords = aTexCoords;
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    gl_Position = projection * view * worldPos;
 }
@@ -0,0 +1,84 @@
+//
+//  model_registry.h
+//  Graphics Engine
+//
+//  Copyright © 2017 Tony. All rights reserved.
+//
+
+#ifndef model_registry_h
+#define model_registry_h
+
+#include "model.h"
+
+#include <climits>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// Shared, immutable model data. The GPU buffers and texture references are freed when the last handle goes away,
+// which has to happen on the context thread.
+typedef std::shared_ptr<const Model> ModelHandle;
+
+// Loads every model file once. While a handle to a model is alive, acquiring the same file again returns the same
+// GPU-resident meshes instead of importing and uploading another copy.
+class ModelRegistry
+{
+public:
+    static ModelRegistry& instance()
+    {
+        static ModelRegistry registry;
+        return registry;
+    }
+
+    // returns the model loaded from a file, loading it if nobody holds it yet. models loaded for shaders that read
+    // different vertex attributes are separate
+    ModelHandle acquire(const string &path, bool gamma = false, unsigned int vertexAttributes = ATTRIBUTES_ALL)
+    {
+        string key = canonicalPath(path) + (gamma ? "|gamma|" : "|linear|") + std::to_string(vertexAttributes);
+        ModelHandle model = models[key].lock();
+        if (!model)
+        {
+            model = ModelHandle(new Model(path, gamma, vertexAttributes), destroy);
+            models[key] = model;
+        }
+        return model;
+    }
+
+    // number of models alive
+    size_t size()
+    {
+        // forget the models whose last handle is gone
+        for (unordered_map<string, std::weak_ptr<const Model> >::iterator it = models.begin(); it != models.end(); )
+        {
+            if (it->second.expired())
+                it = models.erase(it);
+            else
+                ++it;
+        }
+        return models.size();
+    }
+
+private:
+    unordered_map<string, std::weak_ptr<const Model> > models;
+
+    ModelRegistry() {}
+
+    static void destroy(const Model* model)
+    {
+        const_cast<Model*>(model)->Delete();
+        delete model;
+    }
+
+    static string canonicalPath(const string &path)
+    {
+        char resolved[PATH_MAX];
+        if (realpath(path.c_str(), resolved))
+            return resolved;
+        return path;
+    }
+};
+
+#endif /* model_registry_h */
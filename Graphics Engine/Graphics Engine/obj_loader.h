@@ -0,0 +1,543 @@
+//
+//  obj_loader.h
+//  Graphics Engine
+//
+//  Copyright © 2017 Tony. All rights reserved.
+//
+
+#ifndef obj_loader_h
+#define obj_loader_h
+
+#include <glm/glm.hpp>
+
+#include "mapped_file.h"
+#include "mesh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+// One mesh of an OBJ file: a run of faces within one object/group using one material.
+struct ObjMesh {
+    vector<Vertex> vertices;
+    vector<unsigned int> indices;
+    vector<pair<string, string> > textures; // (sampler type, file relative to the model), in Model::processMaterial order
+    bool hasTexCoords, hasNormals;
+
+    ObjMesh() : hasTexCoords(false), hasNormals(false) {}
+};
+
+// Reads Wavefront OBJ/MTL files straight from a memory mapping, without going through Assimp.
+// The result matches what the Assimp path produces with MODEL_IMPORT_FLAGS: polygons are triangulated as fans,
+// V is flipped and tangents can be filled in with computeTangents(). Each distinct position/uv/normal triple becomes
+// one vertex (the Assimp importer emits one vertex per face corner instead).
+class ObjLoader
+{
+public:
+    vector<ObjMesh> meshes;
+
+    ObjLoader() : material(NULL) {}
+
+    // parses an OBJ file and the material libraries it references. false if the file can't be read or has no faces
+    bool load(const string &path)
+    {
+        meshes.clear();
+        current = ObjMesh();
+        welder.clear();
+        material = NULL;
+        MappedFile file;
+        if (!file.open(path))
+            return false;
+        directory = path.substr(0, path.find_last_of('/'));
+
+        const char* p = (const char*)file.data();
+        const char* end = p + file.size();
+        while (p < end)
+        {
+            const char* lineEnd = (const char*)memchr(p, '\n', end - p);
+            if (!lineEnd)
+                lineEnd = end;
+            parseLine(p, lineEnd);
+            p = lineEnd + 1;
+        }
+        finishMesh();
+
+        positions.clear();
+        texCoords.clear();
+        normals.clear();
+        materials.clear();
+        return !meshes.empty();
+    }
+
+    // accumulates per-face tangents/bitangents on the vertices and orthogonalizes them against the normal.
+    // needs texture coordinates and normals, otherwise both stay zero. doesn't touch GL, safe on a worker thread
+    static void computeTangents(ObjMesh &mesh)
+    {
+        if (!mesh.hasTexCoords || !mesh.hasNormals)
+            return;
+        vector<Vertex> &vertices = mesh.vertices;
+        for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+        {
+            Vertex &v0 = vertices[mesh.indices[i]];
+            Vertex &v1 = vertices[mesh.indices[i + 1]];
+            Vertex &v2 = vertices[mesh.indices[i + 2]];
+            glm::vec3 dp1 = v1.Position - v0.Position, dp2 = v2.Position - v0.Position;
+            glm::vec2 duv1 = v1.TexCoords - v0.TexCoords, duv2 = v2.TexCoords - v0.TexCoords;
+            float det = duv1.x * duv2.y - duv2.x * duv1.y;
+            if (det == 0.0f)
+                continue;
+            float r = 1.0f / det;
+            glm::vec3 tangent = (dp1 * duv2.y - dp2 * duv1.y) * r;
+            glm::vec3 bitangent = (dp2 * duv1.x - dp1 * duv2.x) * r;
+            v0.Tangent += tangent; v1.Tangent += tangent; v2.Tangent += tangent;
+            v0.Bitangent += bitangent; v1.Bitangent += bitangent; v2.Bitangent += bitangent;
+        }
+        for (size_t i = 0; i < vertices.size(); i++)
+        {
+            Vertex &vertex = vertices[i];
+            vertex.Tangent = orthonormal(vertex.Tangent, vertex.Normal);
+            vertex.Bitangent = orthonormal(vertex.Bitangent, vertex.Normal);
+        }
+    }
+
+    // the material libraries (mtllib) an OBJ file's contents reference, relative to its directory
+    static vector<string> materialLibraries(const char* data, size_t size)
+    {
+        vector<string> libraries;
+        const char* p = data;
+        const char* end = data + size;
+        while (p < end)
+        {
+            const char* lineEnd = (const char*)memchr(p, '\n', end - p);
+            if (!lineEnd)
+                lineEnd = end;
+            const char* line = skipBlanks(p, lineEnd);
+            if (keyword(line, lineEnd, "mtllib"))
+                libraries.push_back(lastToken(line + 6, lineEnd));
+            p = lineEnd + 1;
+        }
+        return libraries;
+    }
+
+private:
+    struct Material {
+        string name;
+        string diffuse, specular, normal, height;
+    };
+
+    // position/uv/normal indices of a face corner, zero based, -1 when missing
+    struct Corner {
+        int position, texCoord, normal;
+    };
+
+    // open addressing table from corners to the vertex created for them
+    struct Welder {
+        struct Slot {
+            Corner corner;
+            unsigned int index;
+        };
+        vector<Slot> slots;
+        size_t count;
+
+        Welder() : count(0) {}
+
+        void clear()
+        {
+            slots.clear();
+            count = 0;
+        }
+
+        // index of the vertex for a corner; `added` tells whether it is new and has to be created by the caller
+        unsigned int find(const Corner &corner, unsigned int next, bool &added)
+        {
+            if (2 * (count + 1) > slots.size())
+                grow();
+            size_t mask = slots.size() - 1;
+            for (size_t i = hash(corner) & mask; ; i = (i + 1) & mask)
+            {
+                Slot &slot = slots[i];
+                if (slot.corner.position < 0)
+                {
+                    slot.corner = corner;
+                    slot.index = next;
+                    count++;
+                    added = true;
+                    return next;
+                }
+                if (slot.corner.position == corner.position && slot.corner.texCoord == corner.texCoord && slot.corner.normal == corner.normal)
+                {
+                    added = false;
+                    return slot.index;
+                }
+            }
+        }
+
+        static size_t hash(const Corner &corner)
+        {
+            uint64_t h = (uint64_t)(uint32_t)corner.position * 0x9E3779B97F4A7C15ULL;
+            h ^= (uint64_t)(uint32_t)corner.texCoord * 0xC2B2AE3D27D4EB4FULL;
+            h ^= (uint64_t)(uint32_t)corner.normal * 0x165667B19E3779F9ULL;
+            return (size_t)(h ^ (h >> 29));
+        }
+
+        void grow()
+        {
+            vector<Slot> old;
+            old.swap(slots);
+            Slot empty = { { -1, -1, -1 }, 0 };
+            slots.assign(std::max((size_t)1024, old.size() * 2), empty);
+            size_t mask = slots.size() - 1;
+            for (size_t i = 0; i < old.size(); i++)
+            {
+                if (old[i].corner.position < 0)
+                    continue;
+                size_t j = hash(old[i].corner) & mask;
+                while (slots[j].corner.position >= 0)
+                    j = (j + 1) & mask;
+                slots[j] = old[i];
+            }
+        }
+    };
+
+    string directory;
+    vector<glm::vec3> positions;
+    vector<glm::vec2> texCoords;
+    vector<glm::vec3> normals;
+    vector<Material> materials;
+    const Material* material; // of the faces being read
+    ObjMesh current;
+    Welder welder;
+    vector<Corner> corners;
+
+    void parseLine(const char* p, const char* end)
+    {
+        p = skipBlanks(p, end);
+        if (p == end || *p == '#')
+            return;
+        if (p[0] == 'v')
+        {
+            if (p + 1 < end && isBlank(p[1]))
+            {
+                glm::vec3 position;
+                p = parseFloat(p + 1, end, position.x);
+                p = parseFloat(p, end, position.y);
+                parseFloat(p, end, position.z);
+                positions.push_back(position);
+            }
+            else if (p + 2 < end && p[1] == 't' && isBlank(p[2]))
+            {
+                glm::vec2 texCoord;
+                p = parseFloat(p + 2, end, texCoord.x);
+                parseFloat(p, end, texCoord.y);
+                texCoord.y = 1.0f - texCoord.y; // aiProcess_FlipUVs
+                texCoords.push_back(texCoord);
+            }
+            else if (p + 2 < end && p[1] == 'n' && isBlank(p[2]))
+            {
+                glm::vec3 normal;
+                p = parseFloat(p + 2, end, normal.x);
+                p = parseFloat(p, end, normal.y);
+                parseFloat(p, end, normal.z);
+                normals.push_back(normal);
+            }
+        }
+        else if (p[0] == 'f' && p + 1 < end && isBlank(p[1]))
+            parseFace(p + 1, end);
+        else if ((p[0] == 'o' || p[0] == 'g') && (p + 1 == end || isBlank(p[1])))
+            finishMesh();
+        else if (keyword(p, end, "usemtl"))
+        {
+            finishMesh();
+            material = findMaterial(lastToken(p + 6, end));
+        }
+        else if (keyword(p, end, "mtllib"))
+            loadMaterials(lastToken(p + 6, end));
+    }
+
+    void parseFace(const char* p, const char* end)
+    {
+        corners.clear();
+        for (;;)
+        {
+            p = skipBlanks(p, end);
+            if (p == end || !(isDigit(*p) || *p == '-'))
+                break;
+            Corner corner = { -1, -1, -1 };
+            int index;
+            p = parseInt(p, end, index);
+            corner.position = resolve(index, positions.size());
+            if (p < end && *p == '/')
+            {
+                p++;
+                if (p < end && *p != '/')
+                {
+                    p = parseInt(p, end, index);
+                    corner.texCoord = resolve(index, texCoords.size());
+                }
+                if (p < end && *p == '/')
+                {
+                    p = parseInt(p + 1, end, index);
+                    corner.normal = resolve(index, normals.size());
+                }
+            }
+            if (corner.position < 0)
+                return; // broken face, skip it
+            corners.push_back(corner);
+            while (p < end && !isBlank(*p))
+                p++;
+        }
+        // aiProcess_Triangulate, as a fan
+        for (size_t i = 1; i + 1 < corners.size(); i++)
+        {
+            current.indices.push_back(vertexFor(corners[0]));
+            current.indices.push_back(vertexFor(corners[i]));
+            current.indices.push_back(vertexFor(corners[i + 1]));
+        }
+    }
+
+    unsigned int vertexFor(const Corner &corner)
+    {
+        bool added;
+        unsigned int index = welder.find(corner, (unsigned int)current.vertices.size(), added);
+        if (added)
+        {
+            Vertex vertex;
+            vertex.Position = positions[corner.position];
+            vertex.TexCoords = corner.texCoord >= 0 ? texCoords[corner.texCoord] : glm::vec2(0.0f, 0.0f);
+            vertex.Normal = corner.normal >= 0 ? normals[corner.normal] : glm::vec3(0.0f, 0.0f, 0.0f);
+            vertex.Tangent = glm::vec3(0.0f, 0.0f, 0.0f);
+            vertex.Bitangent = glm::vec3(0.0f, 0.0f, 0.0f);
+            current.vertices.push_back(vertex);
+            current.hasTexCoords |= corner.texCoord >= 0;
+            current.hasNormals |= corner.normal >= 0;
+        }
+        return index;
+    }
+
+    // 1 based or, when negative, relative to the end of the list; -1 if out of range
+    static int resolve(int index, size_t count)
+    {
+        long long resolved = index > 0 ? (long long)index - 1 : (long long)count + index;
+        return resolved >= 0 && resolved < (long long)count ? (int)resolved : -1;
+    }
+
+    void finishMesh()
+    {
+        if (!current.indices.empty())
+        {
+            if (material)
+            {
+                if (!material->diffuse.empty())
+                    current.textures.push_back(make_pair(string("texture_diffuse"), material->diffuse));
+                if (!material->specular.empty())
+                    current.textures.push_back(make_pair(string("texture_specular"), material->specular));
+                if (!material->normal.empty())
+                    current.textures.push_back(make_pair(string("texture_normal"), material->normal));
+                if (!material->height.empty())
+                    current.textures.push_back(make_pair(string("texture_height"), material->height));
+            }
+            meshes.push_back(ObjMesh());
+            std::swap(meshes.back(), current);
+        }
+        current = ObjMesh();
+        welder.clear();
+    }
+
+    const Material* findMaterial(const string &name) const
+    {
+        for (size_t i = 0; i < materials.size(); i++)
+            if (materials[i].name == name)
+                return &materials[i];
+        return NULL;
+    }
+
+    // reads the texture maps of a material library, other material properties aren't used by the engine.
+    // the texture types follow Assimp's OBJ importer: map_Kd diffuse, map_Ks specular, bump height
+    // (sampled as texture_normal) and map_Ka ambient (sampled as texture_height)
+    void loadMaterials(const string &name)
+    {
+        MappedFile file;
+        if (!file.open(directory + '/' + name))
+        {
+            std::cout << "ERROR::OBJ:: can't read material library " << name << std::endl;
+            return;
+        }
+        const Material* selected = material;
+        string selectedName = selected ? selected->name : string();
+        const char* p = (const char*)file.data();
+        const char* end = p + file.size();
+        while (p < end)
+        {
+            const char* lineEnd = (const char*)memchr(p, '\n', end - p);
+            if (!lineEnd)
+                lineEnd = end;
+            const char* line = skipBlanks(p, lineEnd);
+            if (keyword(line, lineEnd, "newmtl"))
+            {
+                materials.push_back(Material());
+                materials.back().name = lastToken(line + 6, lineEnd);
+            }
+            else if (!materials.empty())
+            {
+                Material &entry = materials.back();
+                if (keyword(line, lineEnd, "map_Kd"))
+                    entry.diffuse = lastToken(line + 6, lineEnd);
+                else if (keyword(line, lineEnd, "map_Ks"))
+                    entry.specular = lastToken(line + 6, lineEnd);
+                else if (keyword(line, lineEnd, "map_Ka"))
+                    entry.height = lastToken(line + 6, lineEnd);
+                else if (keyword(line, lineEnd, "map_bump") || keyword(line, lineEnd, "map_Bump"))
+                    entry.normal = lastToken(line + 8, lineEnd);
+                else if (keyword(line, lineEnd, "bump"))
+                    entry.normal = lastToken(line + 4, lineEnd);
+            }
+            p = lineEnd + 1;
+        }
+        // the vector may have moved
+        material = selected ? findMaterial(selectedName) : NULL;
+    }
+
+    static glm::vec3 orthonormal(const glm::vec3 &v, const glm::vec3 &normal)
+    {
+        glm::vec3 projected = v - normal * glm::dot(normal, v);
+        float length = std::sqrt(glm::dot(projected, projected));
+        return length > 0.0f ? projected / length : glm::vec3(0.0f, 0.0f, 0.0f);
+    }
+
+    /*  Scanning    */
+    static bool isBlank(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    static bool isDigit(char c)
+    {
+        return (unsigned char)(c - '0') < 10;
+    }
+
+    static const char* skipBlanks(const char* p, const char* end)
+    {
+        while (p < end && isBlank(*p))
+            p++;
+        return p;
+    }
+
+    // whether the line starts with a keyword followed by a blank
+    static bool keyword(const char* p, const char* end, const char* word)
+    {
+        size_t length = strlen(word);
+        return (size_t)(end - p) > length && memcmp(p, word, length) == 0 && isBlank(p[length]);
+    }
+
+    // last blank separated token of the line, skips options such as "-bm 1" in front of a file name
+    static string lastToken(const char* p, const char* end)
+    {
+        while (end > p && isBlank(end[-1]))
+            end--;
+        const char* start = end;
+        while (start > p && !isBlank(start[-1]))
+            start--;
+        return string(start, end);
+    }
+
+    // number of ASCII digits at p, 16 bytes at a time where SSE2 is available
+    static size_t digitRun(const char* p, const char* end)
+    {
+        size_t n = 0;
+#if defined(__SSE2__)
+        const __m128i below = _mm_set1_epi8('0' - 1);
+        const __m128i above = _mm_set1_epi8('9' + 1);
+        while (end - (p + n) >= 16)
+        {
+            __m128i chunk = _mm_loadu_si128((const __m128i*)(p + n));
+            // bytes >= 0x80 compare as negative, so they never count as digits
+            __m128i digits = _mm_and_si128(_mm_cmpgt_epi8(chunk, below), _mm_cmplt_epi8(chunk, above));
+            unsigned int others = ~(unsigned int)_mm_movemask_epi8(digits) & 0xFFFF;
+            if (others)
+                return n + __builtin_ctz(others);
+            n += 16;
+        }
+#endif
+        while (p + n < end && isDigit(p[n]))
+            n++;
+        return n;
+    }
+
+    // accumulates up to 19 digits, the number of digits that didn't fit is returned in `dropped`
+    static uint64_t digitValue(const char* p, size_t count, int &dropped)
+    {
+        size_t used = std::min(count, (size_t)19);
+        uint64_t value = 0;
+        for (size_t i = 0; i < used; i++)
+            value = value * 10 + (uint64_t)(p[i] - '0');
+        dropped = (int)(count - used);
+        return value;
+    }
+
+    static const char* parseInt(const char* p, const char* end, int &value)
+    {
+        bool negative = p < end && *p == '-';
+        if (negative || (p < end && *p == '+'))
+            p++;
+        size_t count = digitRun(p, end);
+        int dropped;
+        uint64_t magnitude = digitValue(p, std::min(count, (size_t)10), dropped);
+        value = (int)std::min(magnitude, (uint64_t)0x7FFFFFFF);
+        if (negative)
+            value = -value;
+        return p + count;
+    }
+
+    static const char* parseFloat(const char* p, const char* end, float &value)
+    {
+        p = skipBlanks(p, end);
+        bool negative = p < end && *p == '-';
+        if (negative || (p < end && *p == '+'))
+            p++;
+        int exponent = 0, dropped;
+        size_t count = digitRun(p, end);
+        uint64_t mantissa = digitValue(p, count, dropped);
+        exponent += dropped;
+        p += count;
+        if (p < end && *p == '.')
+        {
+            p++;
+            count = digitRun(p, end);
+            // digits past what the mantissa holds don't change a float
+            size_t used = 0;
+            for (; used < count && mantissa < 100000000000000000ULL; used++)
+                mantissa = mantissa * 10 + (uint64_t)(p[used] - '0');
+            exponent -= (int)used;
+            p += count;
+        }
+        if (p < end && (*p == 'e' || *p == 'E'))
+        {
+            int power;
+            p = parseInt(p + 1, end, power);
+            exponent += power;
+        }
+        static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                         1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+        double result = (double)mantissa;
+        if (exponent >= 0)
+            result = exponent <= 22 ? result * powers[exponent] : result * std::pow(10.0, exponent);
+        else
+            result = exponent >= -22 ? result / powers[-exponent] : result * std::pow(10.0, exponent);
+        value = (float)(negative ? -result : result);
+        return p;
+    }
+};
+
+#endif /* obj_loader_h */
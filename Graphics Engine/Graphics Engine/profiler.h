@@ -0,0 +1,243 @@
+//
+//  profiler.h
+//  Graphics Engine
+//
+//  Copyright © 2017 Tony. All rights reserved.
+//
+
+#ifndef profiler_h
+#define profiler_h
+
+#include <glad/glad.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+// A single finished profiling scope. Names must be string literals (or otherwise outlive the profiler).
+struct ProfileEvent {
+    const char* name;
+    uint64_t startNs;
+    uint64_t durationNs;
+    uint32_t threadId;
+    bool gpu;
+};
+
+// Fixed size multi-producer ring buffer of events. Writers claim a slot with a single atomic increment and never block;
+// once full, the oldest events are overwritten. Each slot carries a sequence number so readers can skip slots that are
+// being rewritten while they read them.
+class ProfileEventRing
+{
+public:
+    static const uint64_t CAPACITY = 1 << 16;
+
+    ProfileEventRing() : head(0)
+    {
+        for (uint64_t i = 0; i < CAPACITY; i++)
+            sequence[i].store(0, std::memory_order_relaxed);
+    }
+
+    void push(const ProfileEvent &event)
+    {
+        uint64_t index = head.fetch_add(1, std::memory_order_relaxed);
+        uint64_t slot = index & (CAPACITY - 1);
+        sequence[slot].store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        events[slot] = event;
+        sequence[slot].store(index + 1, std::memory_order_release);
+    }
+
+    // copies the event pushed as number `index` into `event`, fails if it is not (or no longer) in the ring
+    bool read(uint64_t index, ProfileEvent &event) const
+    {
+        uint64_t slot = index & (CAPACITY - 1);
+        if (sequence[slot].load(std::memory_order_acquire) != index + 1)
+            return false;
+        event = events[slot];
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return sequence[slot].load(std::memory_order_relaxed) == index + 1;
+    }
+
+    uint64_t size() const
+    {
+        return head.load(std::memory_order_acquire);
+    }
+
+private:
+    ProfileEvent events[CAPACITY];
+    std::atomic<uint64_t> sequence[CAPACITY];
+    std::atomic<uint64_t> head;
+};
+
+// Collects CPU scopes from any thread and GPU scopes (GL_TIME_ELAPSED queries) from the GL thread.
+// GPU queries are double-buffered: the queries of a frame are read back at the end of the next frame, and results that
+// are still not available then are dropped instead of waiting for them, so profiling never stalls the pipeline.
+// GL_TIME_ELAPSED queries can't nest, so GPU scopes must not either.
+class Profiler
+{
+public:
+    bool enabled;
+
+    static Profiler& instance()
+    {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    uint64_t now() const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    void addCpuEvent(const char* name, uint64_t startNs, uint64_t endNs)
+    {
+        ProfileEvent event = { name, startNs, endNs - startNs, threadId(), false };
+        events.push(event);
+    }
+
+    // returns false (and records nothing) if another GPU scope is still open
+    bool beginGpuScope(const char* name, uint64_t cpuStartNs)
+    {
+        GpuFrame &frame = gpuFrames[currentFrame];
+        if (gpuScopeOpen || frame.count == MAX_GPU_SCOPES)
+            return false;
+        if (!queriesCreated)
+        {
+            for (int i = 0; i < 2; i++)
+                glGenQueries(MAX_GPU_SCOPES, gpuFrames[i].queries);
+            queriesCreated = true;
+        }
+        frame.names[frame.count] = name;
+        frame.cpuStartNs[frame.count] = cpuStartNs;
+        glBeginQuery(GL_TIME_ELAPSED, frame.queries[frame.count]);
+        gpuScopeOpen = true;
+        return true;
+    }
+
+    void endGpuScope()
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        gpuFrames[currentFrame].count++;
+        gpuScopeOpen = false;
+    }
+
+    // call once per frame on the GL thread, after the last GPU scope of the frame
+    void endFrame()
+    {
+        currentFrame ^= 1;
+        GpuFrame &previous = gpuFrames[currentFrame];
+        for (int i = 0; i < previous.count; i++)
+        {
+            GLint available = 0;
+            glGetQueryObjectiv(previous.queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                continue;
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(previous.queries[i], GL_QUERY_RESULT, &elapsed);
+            // the GPU track is laid out at the CPU submission time of each scope
+            ProfileEvent event = { previous.names[i], previous.cpuStartNs[i], elapsed, 0, true };
+            events.push(event);
+        }
+        previous.count = 0;
+    }
+
+    // writes all events still in the ring as Chrome trace_event JSON (load it in chrome://tracing or Perfetto)
+    bool writeChromeTrace(const std::string &path) const
+    {
+        std::ofstream file(path.c_str());
+        if (!file)
+        {
+            std::cout << "ERROR::PROFILER:: Could not open " << path << std::endl;
+            return false;
+        }
+        file << "{\"traceEvents\":[\n";
+        file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"GPU\"}}";
+        uint64_t end = events.size();
+        uint64_t begin = end > ProfileEventRing::CAPACITY ? end - ProfileEventRing::CAPACITY : 0;
+        for (uint64_t i = begin; i < end; i++)
+        {
+            ProfileEvent event;
+            if (!events.read(i, event))
+                continue;
+            file << ",\n{\"name\":\"" << event.name << "\",\"cat\":\"" << (event.gpu ? "gpu" : "cpu")
+                 << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.threadId
+                 << ",\"ts\":" << event.startNs / 1000.0 << ",\"dur\":" << event.durationNs / 1000.0 << "}";
+        }
+        file << "\n]}\n";
+        return true;
+    }
+
+private:
+    static const int MAX_GPU_SCOPES = 32;
+
+    struct GpuFrame {
+        unsigned int queries[MAX_GPU_SCOPES];
+        const char* names[MAX_GPU_SCOPES];
+        uint64_t cpuStartNs[MAX_GPU_SCOPES];
+        int count;
+    };
+
+    std::chrono::steady_clock::time_point epoch;
+    ProfileEventRing events;
+    GpuFrame gpuFrames[2];
+    int currentFrame;
+    bool gpuScopeOpen;
+    bool queriesCreated;
+    std::atomic<uint32_t> nextThreadId;
+
+    Profiler() : enabled(false), epoch(std::chrono::steady_clock::now()), currentFrame(0), gpuScopeOpen(false), queriesCreated(false), nextThreadId(1)
+    {
+        gpuFrames[0].count = gpuFrames[1].count = 0;
+    }
+
+    // small sequential thread ids, 0 is reserved for the GPU track
+    uint32_t threadId()
+    {
+        static thread_local uint32_t id = nextThreadId.fetch_add(1);
+        return id;
+    }
+};
+
+// Times the enclosing block on the CPU, and on the GPU as well if `gpu` is set.
+class ProfileScope
+{
+public:
+    ProfileScope(const char* name, bool gpu = false) : name(name), gpu(false)
+    {
+        Profiler &profiler = Profiler::instance();
+        if (!profiler.enabled)
+        {
+            this->name = NULL;
+            return;
+        }
+        start = profiler.now();
+        if (gpu)
+            this->gpu = profiler.beginGpuScope(name, start);
+    }
+
+    ~ProfileScope()
+    {
+        if (!name)
+            return;
+        Profiler &profiler = Profiler::instance();
+        if (gpu)
+            profiler.endGpuScope();
+        profiler.addCpuEvent(name, start, profiler.now());
+    }
+
+private:
+    const char* name;
+    bool gpu;
+    uint64_t start;
+};
+
+#define PROFILE_CONCAT_IMPL(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_IMPL(a, b)
+// profiles the rest of the enclosing block
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_GPU_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name, true)
+
+#endif /* profiler_h */
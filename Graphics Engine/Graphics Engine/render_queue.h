@@ -0,0 +1,128 @@
+//
+//  render_queue.h
+//  Graphics Engine
+//
+//  Copyright © 2017 Tony. All rights reserved.
+//
+
+#ifndef render_queue_h
+#define render_queue_h
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+using namespace std;
+
+// Passes of a frame's render queue, in the order they are drawn
+enum RenderPass {
+    RENDER_PASS_DEPTH = 0, // model depth pre-pass, no color writes
+    RENDER_PASS_OPAQUE = 1
+};
+
+// Sort key of a draw, most significant field first:
+//   pass (4 bits) | shader (8) | material (20) | vertex array (12) | depth (20)
+// so sorting draws a pass at a time, each shader's draws together, and within them the draws sharing textures and
+// then vertex arrays one after another, nearest first. Names that don't fit their field are cut to their low bits,
+// which only costs a state change when two of them collide.
+const int RENDER_KEY_SHADER_BITS = 8;
+const int RENDER_KEY_MATERIAL_BITS = 20;
+const int RENDER_KEY_VERTEX_ARRAY_BITS = 12;
+const int RENDER_KEY_DEPTH_BITS = 20;
+
+// `depth` goes from 0 at the eye to 1 at the far plane (front to back for opaque draws)
+inline uint64_t renderKey(RenderPass pass, unsigned int shader, unsigned int material, unsigned int vertexArray, float depth)
+{
+    const uint64_t depthMax = (1u << RENDER_KEY_DEPTH_BITS) - 1;
+    uint64_t quantized = (uint64_t)(std::min(std::max(depth, 0.0f), 1.0f) * depthMax);
+    uint64_t key = (uint64_t)pass;
+    key = (key << RENDER_KEY_SHADER_BITS) | (shader & ((1u << RENDER_KEY_SHADER_BITS) - 1));
+    key = (key << RENDER_KEY_MATERIAL_BITS) | (material & ((1u << RENDER_KEY_MATERIAL_BITS) - 1));
+    key = (key << RENDER_KEY_VERTEX_ARRAY_BITS) | (vertexArray & ((1u << RENDER_KEY_VERTEX_ARRAY_BITS) - 1));
+    return (key << RENDER_KEY_DEPTH_BITS) | quantized;
+}
+
+inline RenderPass renderKeyPass(uint64_t key)
+{
+    return (RenderPass)(key >> (RENDER_KEY_SHADER_BITS + RENDER_KEY_MATERIAL_BITS + RENDER_KEY_VERTEX_ARRAY_BITS + RENDER_KEY_DEPTH_BITS));
+}
+
+inline unsigned int renderKeyShader(uint64_t key)
+{
+    return (unsigned int)(key >> (RENDER_KEY_MATERIAL_BITS + RENDER_KEY_VERTEX_ARRAY_BITS + RENDER_KEY_DEPTH_BITS)) & ((1u << RENDER_KEY_SHADER_BITS) - 1);
+}
+
+// A draw in the queue: its key and whatever the submitter needs to find the draw again.
+struct RenderCommand {
+    uint64_t key;
+    uint32_t item;
+};
+
+// Collects a pass's draws in any order and sorts them by key for submission. The queue keeps its storage from
+// frame to frame, so it only allocates while it grows.
+class RenderQueue
+{
+public:
+    void clear()
+    {
+        commands.clear();
+    }
+
+    void submit(uint64_t key, uint32_t item)
+    {
+        RenderCommand command = { key, item };
+        commands.push_back(command);
+    }
+
+    // sorts by key, keeping draws with equal keys in the order they were submitted. LSD radix sort on bytes, which
+    // skips the bytes all keys share (usually most of the high ones)
+    void sort()
+    {
+        size_t count = commands.size();
+        if (count < 2)
+            return;
+        size_t histograms[8][256];
+        memset(histograms, 0, sizeof(histograms));
+        for (size_t i = 0; i < count; i++)
+            for (int b = 0; b < 8; b++)
+                histograms[b][(commands[i].key >> (8 * b)) & 0xff]++;
+
+        scratch.resize(count);
+        RenderCommand* from = &commands[0];
+        RenderCommand* to = &scratch[0];
+        for (int b = 0; b < 8; b++)
+        {
+            size_t* histogram = histograms[b];
+            if (histogram[(from[0].key >> (8 * b)) & 0xff] == count)
+                continue; // every key has the same byte here
+            size_t offset = 0;
+            for (int d = 0; d < 256; d++)
+            {
+                size_t digits = histogram[d];
+                histogram[d] = offset;
+                offset += digits;
+            }
+            for (size_t i = 0; i < count; i++)
+                to[histogram[(from[i].key >> (8 * b)) & 0xff]++] = from[i];
+            std::swap(from, to);
+        }
+        if (from != &commands[0])
+            memcpy(&commands[0], from, count * sizeof(RenderCommand));
+    }
+
+    size_t size() const
+    {
+        return commands.size();
+    }
+
+    const RenderCommand& operator[](size_t i) const
+    {
+        return commands[i];
+    }
+
+private:
+    vector<RenderCommand> commands;
+    vector<RenderCommand> scratch;
+};
+
+#endif /* render_queue_h */
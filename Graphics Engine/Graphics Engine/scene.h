@@ -0,0 +1,110 @@
+//
+//  scene.h
+//  Graphics Engine
+//
+//  Copyright © 2017 Tony. All rights reserved.
+//
+
+#ifndef scene_h
+#define scene_h
+
+#include <glm/glm.hpp>
+
+#include "model.h"
+#include "model_registry.h"
+#include "shader.h"
+
+#include <cstdint>
+#include <vector>
+using namespace std;
+
+// Refers to an element of a Scene by its index. The type only keeps handles of different kinds apart.
+template<typename T>
+struct Handle {
+    static const uint32_t INVALID = 0xffffffff;
+
+    uint32_t index;
+
+    Handle() : index(INVALID) {}
+    explicit Handle(uint32_t index) : index(index) {}
+
+    bool valid() const
+    {
+        return index != INVALID;
+    }
+};
+
+struct SceneObject;
+typedef Handle<Shader> ShaderId;
+typedef Handle<Model> ModelId;
+typedef Handle<SceneObject> ObjectId;
+
+// One placement of a scene model: its own transform and texture overrides, the meshes stay shared.
+struct SceneObject {
+    ModelId model;
+    glm::mat4 transform;
+    vector<Texture> overrides; // replace the model's textures of the same type, owned by whoever set them
+};
+
+// Everything a frame draws, set up before the render loop. The passes get the scene by reference and name its
+// shaders and models by handle; its objects are one contiguous list, which each frame records into a DrawList once
+// for all passes, so a frame copies no model data and allocates nothing. Handles stay valid until clear().
+class Scene
+{
+public:
+    ShaderId addShader(const Shader &shader)
+    {
+        shaders.push_back(shader);
+        return ShaderId((uint32_t)shaders.size() - 1);
+    }
+
+    ModelId addModel(const ModelHandle &model)
+    {
+        models.push_back(model);
+        return ModelId((uint32_t)models.size() - 1);
+    }
+
+    ObjectId addObject(ModelId model, const glm::mat4 &transform = glm::mat4(1.0f))
+    {
+        SceneObject object;
+        object.model = model;
+        object.transform = transform;
+        objects.push_back(object);
+        return ObjectId((uint32_t)objects.size() - 1);
+    }
+
+    const Shader& shader(ShaderId id) const
+    {
+        return shaders[id.index];
+    }
+
+    const Model& model(ModelId id) const
+    {
+        return *models[id.index];
+    }
+
+    SceneObject& object(ObjectId id)
+    {
+        return objects[id.index];
+    }
+
+    const vector<SceneObject>& allObjects() const
+    {
+        return objects;
+    }
+
+    // drops every object, shader and model handle; the models are freed if nobody else holds them
+    void clear()
+    {
+        objects.clear();
+        models.clear();
+        shaders.clear();
+    }
+
+private:
+    vector<Shader> shaders;
+    vector<ModelHandle> models;
+    vector<SceneObject> objects;
+};
+
+#endif /* scene_h */
@@ -11,24 +11,55 @@
 
 #include <glad/glad.h> // include glad to get all the required OpenGL headers
 
+#include "gl_state.h"
+
+#include <algorithm>
+#include <cstdint>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <stdexcept>
+#include <vector>
 
 // include glm
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+// 64-bit FNV-1a hash of a uniform name, evaluated by the compiler for constant names (see UniformName)
+constexpr uint64_t uniformHash(const char* name, uint64_t hash = 14695981039346656037ull)
+{
+    return *name ? uniformHash(name + 1, (hash ^ (uint64_t)(unsigned char)*name) * 1099511628211ull) : hash;
+}
+
+// A uniform name as the shader looks it up: by hash. Declare names that are looked up often as constexpr
+// constants, so their hash is computed at compile time. The whole 64-bit hash is compared on lookup, two of a
+// program's uniforms with the same hash fail its link (see Shader::reflectUniforms).
+struct UniformName {
+    uint64_t hash;
+
+    constexpr UniformName(const char* name) : hash(uniformHash(name)) {}
+};
+
+// A uniform's location resolved once (Shader::uniform), typed by the value it takes so Shader::set picks the right
+// glUniform call. Location -1 (a uniform the program doesn't use) is ignored by GL.
+template<typename T>
+struct Uniform {
+    GLint location;
+
+    Uniform() : location(-1) {}
+    explicit Uniform(GLint location) : location(location) {}
+};
+
 class Shader
 {
 public:
     // the program ID
     unsigned int ID;
     
-    // constructor reads and builds the shader
-    Shader(const char* vertexPath, const char* fragmentPath)
+    // constructor reads and builds the shader, `defines` (e.g. "#define X\n") are inserted after the #version line of both stages
+    Shader(const char* vertexPath, const char* fragmentPath, const char* defines = NULL)
     {
         // 1. retrieve the vertex/fragment source code from filePath
         std::string vertexCode;
@@ -58,6 +89,11 @@ public:
         {
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
         }
+        if (defines)
+        {
+            vertexCode = addDefines(vertexCode, defines);
+            fragmentCode = addDefines(fragmentCode, defines);
+        }
         const char* vShaderCode = vertexCode.c_str();
         const char * fShaderCode = fragmentCode.c_str();
         // 2. compile shaders
@@ -83,31 +119,134 @@ public:
         // delete the shaders as they're linked into our program now and no longer necessary
         glDeleteShader(vertex);
         glDeleteShader(fragment);
-    }    // use/activate the shader
-    void use()
+        reflectUniforms();
+    }    // use/activate the shader, unless it's in use already (see GLState)
+    void use() const
     {
-        glUseProgram(ID);
+        GLState::instance().useProgram(ID);
     }
     
-    // utility uniform functions
-    void setBool(const std::string &name, bool value) const
+    // location of an active uniform, -1 if the program has none of that name. looked up in the table reflected at
+    // link time, without asking GL
+    GLint location(UniformName name) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+        if (uniforms.empty())
+            return -1;
+        size_t mask = uniforms.size() - 1;
+        for (size_t i = (size_t)name.hash & mask; ; i = (i + 1) & mask)
+        {
+            if (uniforms[i].location < 0)
+                return -1;
+            if (uniforms[i].hash == name.hash)
+                return uniforms[i].location;
+        }
+    }
+    
+    // resolves a uniform once, for setting it through set() as often as needed
+    template<typename T>
+    Uniform<T> uniform(UniformName name) const
+    {
+        return Uniform<T>(location(name));
     }
-    void setInt(const std::string &name, int value) const
+    
+    // typed uniform setters, the program must be in use
+    void set(Uniform<int> uniform, int value) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+        glUniform1i(uniform.location, value);
     }
-    void setFloat(const std::string &name, float value) const
+    void set(Uniform<float> uniform, float value) const
     {
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+        glUniform1f(uniform.location, value);
     }
-    void setMat4(const std::string &name, glm::mat4 matrix) const
+    void set(Uniform<glm::vec3> uniform, const glm::vec3 &value) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, glm::value_ptr(matrix));
+        glUniform3fv(uniform.location, 1, glm::value_ptr(value));
+    }
+    void set(Uniform<glm::vec4> uniform, const glm::vec4 &value) const
+    {
+        glUniform4fv(uniform.location, 1, glm::value_ptr(value));
+    }
+    void set(Uniform<glm::mat4> uniform, const glm::mat4 &matrix) const
+    {
+        glUniformMatrix4fv(uniform.location, 1, GL_FALSE, glm::value_ptr(matrix));
+    }
+    
+    // utility uniform functions, for uniforms set once or rarely
+    void setBool(UniformName name, bool value) const
+    {
+        glUniform1i(location(name), (int)value);
+    }
+    void setInt(UniformName name, int value) const
+    {
+        glUniform1i(location(name), value);
+    }
+    void setFloat(UniformName name, float value) const
+    {
+        glUniform1f(location(name), value);
+    }
+    void setMat4(UniformName name, const glm::mat4 &matrix) const
+    {
+        glUniformMatrix4fv(location(name), 1, GL_FALSE, glm::value_ptr(matrix));
     }
     
 private:
+    struct UniformSlot {
+        uint64_t hash;
+        GLint location; // -1 for an empty slot
+    };
+    
+    // open addressing by name hash, a power of two at least twice the number of active uniforms
+    std::vector<UniformSlot> uniforms;
+    
+    // fills the uniform table from the linked program's active uniforms. throws if two of them hash alike, as one
+    // of them could not be looked up
+    void reflectUniforms()
+    {
+        GLint count = 0, maxLength = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        size_t size = 16;
+        while (size < 2 * (size_t)count)
+            size *= 2;
+        UniformSlot empty = { 0, -1 };
+        uniforms.assign(size, empty);
+        std::vector<char> name(std::max(maxLength, 1));
+        for (GLint u = 0; u < count; u++)
+        {
+            GLsizei length = 0;
+            GLint arraySize = 0;
+            GLenum type = 0;
+            glGetActiveUniform(ID, (GLuint)u, (GLsizei)name.size(), &length, &arraySize, &type, &name[0]);
+            GLint uniformLocation = glGetUniformLocation(ID, &name[0]);
+            if (uniformLocation < 0)
+                continue; // in a uniform block
+            // arrays are reported as "name[0]", look them up by their plain name
+            std::string plain(&name[0], length);
+            if (plain.size() > 3 && plain.compare(plain.size() - 3, 3, "[0]") == 0)
+                plain.resize(plain.size() - 3);
+            uint64_t hash = uniformHash(plain.c_str());
+            size_t i = (size_t)hash & (size - 1);
+            while (uniforms[i].location >= 0 && uniforms[i].hash != hash)
+                i = (i + 1) & (size - 1);
+            if (uniforms[i].location >= 0)
+            {
+                std::cout << "ERROR::SHADER::UNIFORM_HASH_COLLISION " << plain << std::endl;
+                throw std::runtime_error("uniform hash collision: " + plain);
+            }
+            uniforms[i].hash = hash;
+            uniforms[i].location = uniformLocation;
+        }
+    }
+    
+
+    static std::string addDefines(const std::string &code, const char* defines)
+    {
+        size_t versionEnd = code.compare(0, 8, "#version") == 0 ? code.find('\n') : std::string::npos;
+        if (versionEnd == std::string::npos)
+            return defines + code;
+        return code.substr(0, versionEnd + 1) + defines + code.substr(versionEnd + 1);
+    }
+    
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
     void checkCompileErrors(unsigned int shader, std::string type)
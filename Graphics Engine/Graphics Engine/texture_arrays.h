@@ -0,0 +1,252 @@
+//
+//  texture_arrays.h
+//  Graphics Engine
+//
+//  Copyright © 2017 Tony. All rights reserved.
+//
+
+#ifndef texture_arrays_h
+#define texture_arrays_h
+
+#include <glad/glad.h>
+
+#include "gl_state.h"
+#include "mipmap.h"
+#include "texture_streamer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// layers of a texture array at most, it starts with one and doubles when it's full (GL 3.3 guarantees 256)
+const int TEXTURE_ARRAY_LAYERS = 256;
+
+// texture unit the model shader's materialArray sampler reads, apart from the units of the mesh's own textures
+const int MATERIAL_ARRAY_UNIT = 8;
+
+// Where a packed texture lives: one layer of a GL_TEXTURE_2D_ARRAY.
+struct TextureLayer {
+    unsigned int array;
+    int layer;
+    bool resident; // every level has been uploaded
+};
+
+// Packs material textures of the same size, format, mip count and sampling state into GL_TEXTURE_2D_ARRAYs, so
+// meshes with different materials only differ in the layer they sample and can be drawn one after another without
+// binding textures. A packed texture keeps its own 2D texture name, which stays the placeholder and is what
+// everything else (the registry, overrides) refers to; find() maps it to its layer once it's resident.
+// An array only has as many layers as it needs, rounded up to a power of two: a full array is given twice the
+// layers in place, its name and the layers it has are kept.
+class TextureArrays
+{
+public:
+    static TextureArrays& instance()
+    {
+        static TextureArrays arrays;
+        return arrays;
+    }
+
+    // reserves a layer for a decoded image, in an array created with `wrap`, `minFilter` and `magFilter`
+    const TextureLayer& allocate(unsigned int textureID, const TextureImage &image, GLint wrap, GLint minFilter, GLint magFilter)
+    {
+        char key[128];
+        snprintf(key, sizeof(key), "%dx%d:%d:%x:%zu:%x:%x:%x", image.width, image.height, image.components, image.format,
+                 image.levels.size(), wrap, minFilter, magFilter);
+        vector<Array> &bucket = buckets[key];
+        size_t a = 0;
+        while (a < bucket.size() && bucket[a].freeLayers.empty() && bucket[a].layers == TEXTURE_ARRAY_LAYERS)
+            a++;
+        if (a == bucket.size())
+            bucket.push_back(createArray(image, wrap, minFilter, magFilter));
+        Array &array = bucket[a];
+        if (array.freeLayers.empty())
+            grow(array, array.layers * 2);
+
+        TextureLayer &layer = layers[textureID];
+        layer.array = array.texture;
+        layer.layer = array.freeLayers.back();
+        layer.resident = false;
+        array.freeLayers.pop_back();
+        owners[textureID] = key;
+        return layer;
+    }
+
+    // the streamer finished uploading a texture's layer (see TextureStreamer::takeCompletedLayers)
+    void layerComplete(unsigned int textureID)
+    {
+        unordered_map<unsigned int, TextureLayer>::iterator it = layers.find(textureID);
+        if (it != layers.end())
+            it->second.resident = true;
+    }
+
+    // the layer of a texture, NULL if it isn't packed or still streaming
+    const TextureLayer* find(unsigned int textureID) const
+    {
+        unordered_map<unsigned int, TextureLayer>::const_iterator it = layers.find(textureID);
+        if (it == layers.end() || !it->second.resident)
+            return NULL;
+        return &it->second;
+    }
+
+    // frees a texture's layer, and its array with the last layer in use; for textures that aren't packed it does nothing.
+    // uploads still queued for the layer must be cancelled first (see TextureLoader::cancel)
+    void release(unsigned int textureID)
+    {
+        unordered_map<unsigned int, TextureLayer>::iterator it = layers.find(textureID);
+        if (it == layers.end())
+            return;
+        vector<Array> &bucket = buckets[owners[textureID]];
+        for (size_t a = 0; a < bucket.size(); a++)
+        {
+            if (bucket[a].texture != it->second.array)
+                continue;
+            bucket[a].freeLayers.push_back(it->second.layer);
+            if ((int)bucket[a].freeLayers.size() == bucket[a].layers)
+            {
+                GLState::instance().deleteTexture(bucket[a].texture);
+                bucket.erase(bucket.begin() + a);
+            }
+            break;
+        }
+        layers.erase(it);
+        owners.erase(textureID);
+    }
+
+    // number of arrays alive
+    size_t size() const
+    {
+        size_t count = 0;
+        for (map<string, vector<Array> >::const_iterator it = buckets.begin(); it != buckets.end(); ++it)
+            count += it->second.size();
+        return count;
+    }
+
+    // deletes all arrays, call once no texture is left
+    void clear()
+    {
+        for (map<string, vector<Array> >::iterator it = buckets.begin(); it != buckets.end(); ++it)
+            for (size_t a = 0; a < it->second.size(); a++)
+                GLState::instance().deleteTexture(it->second[a].texture);
+        buckets.clear();
+        layers.clear();
+        owners.clear();
+    }
+
+private:
+    struct Array {
+        unsigned int texture;
+        int layers;
+        vector<int> freeLayers;
+        TextureImage shape; // size and format of every layer, no pixels
+    };
+
+    map<string, vector<Array> > buckets;                // by size, format and sampling state
+    unordered_map<unsigned int, TextureLayer> layers;   // by 2D texture name
+    unordered_map<unsigned int, string> owners;         // bucket of each packed texture
+
+    TextureArrays() {}
+
+    // an array of one layer with every level allocated and no data, so it's complete however many layers are filled
+    static Array createArray(const TextureImage &image, GLint wrap, GLint minFilter, GLint magFilter)
+    {
+        Array array;
+        array.layers = 1;
+        array.freeLayers.push_back(0);
+        array.shape.width = image.width;
+        array.shape.height = image.height;
+        array.shape.components = image.components;
+        array.shape.format = image.format;
+        array.shape.blockBytes = image.blockBytes;
+        array.shape.levels = image.levels;
+        glGenTextures(1, &array.texture);
+        GLState::instance().selectTexture(TEXTURE_UPLOAD_UNIT, GL_TEXTURE_2D_ARRAY, array.texture);
+        GLint unpackBuffer = 0;
+        glGetIntegerv(GL_PIXEL_UNPACK_BUFFER_BINDING, &unpackBuffer);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        allocateLevels(array.shape, array.layers);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, unpackBuffer);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, wrap);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, wrap);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, minFilter);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, magFilter);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, (GLint)image.levels.size() - 1);
+        return array;
+    }
+
+    // (re)specifies every level of the bound array with `layers` layers and no data, the unpack buffer must be unbound
+    static void allocateLevels(const TextureImage &shape, int layers)
+    {
+        GLenum format = textureFormat(shape.components);
+        for (size_t l = 0; l < shape.levels.size(); l++)
+        {
+            const MipLevel &level = shape.levels[l];
+            if (shape.format)
+                glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, (GLint)l, shape.format, level.width, level.height, layers, 0,
+                                       (GLsizei)(shape.levelSize(l) * layers), NULL);
+            else
+                glTexImage3D(GL_TEXTURE_2D_ARRAY, (GLint)l, format, level.width, level.height, layers, 0, format, GL_UNSIGNED_BYTE, NULL);
+        }
+    }
+
+    // gives a full array room for `layers` layers under the same name. every level is read back into a pixel buffer,
+    // respecified with more layers and written back from the buffer, so the copy doesn't leave the GPU; uploads the
+    // streamer issued before into a layer are part of it
+    static void grow(Array &array, int layers)
+    {
+        layers = std::min(layers, TEXTURE_ARRAY_LAYERS);
+        const TextureImage &shape = array.shape;
+        vector<size_t> offsets(shape.levels.size());
+        size_t size = 0;
+        for (size_t l = 0; l < shape.levels.size(); l++)
+        {
+            offsets[l] = size;
+            size += shape.levelSize(l) * array.layers;
+        }
+        GLint unpackBuffer = 0;
+        glGetIntegerv(GL_PIXEL_UNPACK_BUFFER_BINDING, &unpackBuffer);
+        unsigned int buffer;
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_COPY);
+        GLState::instance().selectTexture(TEXTURE_UPLOAD_UNIT, GL_TEXTURE_2D_ARRAY, array.texture);
+        GLenum format = textureFormat(shape.components);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        for (size_t l = 0; l < shape.levels.size(); l++)
+        {
+            if (shape.format)
+                glGetCompressedTexImage(GL_TEXTURE_2D_ARRAY, (GLint)l, (void*)offsets[l]);
+            else
+                glGetTexImage(GL_TEXTURE_2D_ARRAY, (GLint)l, format, GL_UNSIGNED_BYTE, (void*)offsets[l]);
+        }
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        allocateLevels(shape, layers);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (size_t l = 0; l < shape.levels.size(); l++)
+        {
+            const MipLevel &level = shape.levels[l];
+            if (shape.format)
+                glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, (GLint)l, 0, 0, 0, level.width, level.height, array.layers, shape.format,
+                                          (GLsizei)(shape.levelSize(l) * array.layers), (void*)offsets[l]);
+            else
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, (GLint)l, 0, 0, 0, level.width, level.height, array.layers, format, GL_UNSIGNED_BYTE, (void*)offsets[l]);
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, unpackBuffer);
+        glDeleteBuffers(1, &buffer);
+
+        for (int layer = layers - 1; layer >= array.layers; layer--)
+            array.freeLayers.push_back(layer); // lowest first
+        array.layers = layers;
+    }
+};
+
+#endif /* texture_arrays_h */
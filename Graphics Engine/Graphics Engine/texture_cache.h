@@ -0,0 +1,224 @@
+//
+//  texture_cache.h
+//  Graphics Engine
+//
+//  Copyright © 2017 Tony. All rights reserved.
+//
+
+#ifndef texture_cache_h
+#define texture_cache_h
+
+#include "mapped_file.h"
+#include "mipmap.h"
+#include "texture_compression.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Textures with their mip chains, block compressed where the context supports it, next to the image they were made
+// from, so only the first load decodes, mipmaps and compresses an image. An image loaded with different settings has
+// a cache for each.
+//
+// Layout (in the spirit of KTX2): TextureCacheHeader, TextureCacheLevel[levelCount] level 0 first, then the level
+// data, each level 16 byte aligned and ready for glCompressedTexImage2D (or glTexImage2D when `format` is 0).
+// Bump TEXTURE_CACHE_VERSION whenever the layout or the encoders' output changes.
+const uint32_t TEXTURE_CACHE_VERSION = 2;
+
+// TextureCacheKey::flags
+const uint32_t TEXTURE_CACHE_FLIPPED = 1;
+const uint32_t TEXTURE_CACHE_SRGB = 2;
+
+// Identifies the exact input a cache was built from.
+struct TextureCacheKey {
+    FileStamp stamp;
+    uint64_t hash;
+    uint32_t compression; // TextureCompression
+    uint32_t mipFilter;   // MipFilter
+    uint32_t flags;       // TEXTURE_CACHE_*
+
+    // stats and hashes the source image, only stats it if its hash is given
+    bool read(const string &sourcePath, TextureCompression textureCompression, MipFilter filter, bool flipVertically, bool srgb,
+              const uint64_t* knownHash = NULL)
+    {
+        if (!stamp.read(sourcePath))
+            return false;
+        if (knownHash)
+            hash = *knownHash;
+        else
+        {
+            MappedFile source;
+            if (!source.open(sourcePath))
+                return false;
+            hash = hashBytes(source.data(), source.size());
+        }
+        compression = textureCompression;
+        mipFilter = filter;
+        flags = (flipVertically ? TEXTURE_CACHE_FLIPPED : 0) | (srgb ? TEXTURE_CACHE_SRGB : 0);
+        return true;
+    }
+
+    // hash of the settings the image is processed with, in hex
+    string settingsDigest() const
+    {
+        uint32_t settings[3] = { compression, mipFilter, flags };
+        char digest[16];
+        snprintf(digest, sizeof(digest), "%08x", (uint32_t)hashBytes(settings, sizeof(settings)));
+        return digest;
+    }
+};
+
+struct TextureCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t sourceSize;
+    int64_t sourceMtime;
+    uint64_t sourceHash;
+    uint32_t compression;
+    uint32_t mipFilter;
+    uint32_t flags;
+    uint32_t format; // GL internal format of the blocks, 0 for 8 bit pixels
+    uint32_t blockBytes;
+    uint32_t width;
+    uint32_t height;
+    uint32_t components; // of the source image
+    uint32_t levelCount;
+    uint32_t reserved;
+};
+
+struct TextureCacheLevel {
+    uint32_t width;
+    uint32_t height;
+    uint64_t offset; // from the start of the file
+    uint64_t size;
+};
+
+class TextureCache
+{
+public:
+    // the cache file that belongs to an image file loaded with the settings of `key`
+    static string pathFor(const string &sourcePath, const TextureCacheKey &key)
+    {
+        return sourcePath + "." + key.settingsDigest() + ".texcache";
+    }
+
+    // reads a cached texture, fails if the cache is missing, corrupt, was built from different input or holds a
+    // format other than the one the image would get now (e.g. on a context with other extensions)
+    static bool read(const string &cachePath, const TextureCacheKey &key, unsigned int supported, TextureImage &image)
+    {
+        MappedFile file;
+        if (!file.open(cachePath) || file.size() < sizeof(TextureCacheHeader))
+            return false;
+        const TextureCacheHeader* header = (const TextureCacheHeader*)file.data();
+        if (memcmp(header->magic, "GETC", 4) != 0 || header->version != TEXTURE_CACHE_VERSION
+            || header->sourceSize != key.stamp.size || header->sourceMtime != key.stamp.mtime || header->sourceHash != key.hash
+            || header->compression != key.compression || header->mipFilter != key.mipFilter || header->flags != key.flags
+            || header->format != compressedTextureFormat((TextureCompression)key.compression, (int)header->components, supported)
+            || header->blockBytes != (header->format ? (uint32_t)compressedBlockBytes(header->format) : 0) || header->levelCount == 0
+            || sizeof(TextureCacheHeader) + (uint64_t)header->levelCount * sizeof(TextureCacheLevel) > file.size())
+            return false;
+
+        image.width = (int)header->width;
+        image.height = (int)header->height;
+        image.components = (int)header->components;
+        image.format = header->format;
+        image.blockBytes = (int)header->blockBytes;
+        image.levels.resize(header->levelCount);
+        const TextureCacheLevel* levels = (const TextureCacheLevel*)(file.data() + sizeof(TextureCacheHeader));
+        size_t total = 0;
+        for (uint32_t l = 0; l < header->levelCount; l++)
+        {
+            image.levels[l].width = (int)levels[l].width;
+            image.levels[l].height = (int)levels[l].height;
+            image.levels[l].offset = total;
+            // every level must be where and as large as the header says
+            if (levels[l].size != image.levelSize(l) || levels[l].offset + levels[l].size > file.size())
+                return false;
+            total += levels[l].size;
+        }
+        image.pixels.resize(total);
+        for (uint32_t l = 0; l < header->levelCount; l++)
+            memcpy(&image.pixels[image.levels[l].offset], file.data() + levels[l].offset, levels[l].size);
+        return true;
+    }
+
+    // writes the cache of a freshly compressed texture, through a temporary file of its own (see temporaryPath) so
+    // readers never see a partial cache
+    static bool write(const string &cachePath, const TextureCacheKey &key, const TextureImage &image)
+    {
+        TextureCacheHeader header;
+        memcpy(header.magic, "GETC", 4);
+        header.version = TEXTURE_CACHE_VERSION;
+        header.sourceSize = key.stamp.size;
+        header.sourceMtime = key.stamp.mtime;
+        header.sourceHash = key.hash;
+        header.compression = key.compression;
+        header.mipFilter = key.mipFilter;
+        header.flags = key.flags;
+        header.format = image.format;
+        header.blockBytes = (uint32_t)image.blockBytes;
+        header.width = (uint32_t)image.width;
+        header.height = (uint32_t)image.height;
+        header.components = (uint32_t)image.components;
+        header.levelCount = (uint32_t)image.levels.size();
+        header.reserved = 0;
+
+        vector<TextureCacheLevel> levels(image.levels.size());
+        uint64_t offset = sizeof(TextureCacheHeader) + levels.size() * sizeof(TextureCacheLevel);
+        for (size_t l = 0; l < levels.size(); l++)
+        {
+            offset = align(offset, 16);
+            levels[l].width = (uint32_t)image.levels[l].width;
+            levels[l].height = (uint32_t)image.levels[l].height;
+            levels[l].offset = offset;
+            levels[l].size = image.levelSize(l);
+            offset += levels[l].size;
+        }
+
+        string tempPath = temporaryPath(cachePath);
+        FILE* out = fopen(tempPath.c_str(), "wb");
+        if (!out)
+            return false;
+        bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+        if (!levels.empty())
+            ok = ok && fwrite(&levels[0], sizeof(TextureCacheLevel), levels.size(), out) == levels.size();
+        for (size_t l = 0; l < levels.size() && ok; l++)
+        {
+            ok = ok && pad(out, levels[l].offset);
+            ok = ok && fwrite(image.level(l), 1, levels[l].size, out) == levels[l].size;
+        }
+        ok = fclose(out) == 0 && ok;
+        if (!ok || rename(tempPath.c_str(), cachePath.c_str()) != 0)
+        {
+            remove(tempPath.c_str());
+            std::cout << "WARNING::TEXTURE_CACHE:: Could not write " << cachePath << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static uint64_t align(uint64_t offset, uint64_t alignment)
+    {
+        return (offset + alignment - 1) & ~(alignment - 1);
+    }
+
+    // writes zeros up to the given file offset
+    static bool pad(FILE* out, uint64_t offset)
+    {
+        long position = ftell(out);
+        while (position >= 0 && (uint64_t)position < offset)
+        {
+            if (fputc(0, out) == EOF)
+                return false;
+            position++;
+        }
+        return position >= 0;
+    }
+};
+
+#endif /* texture_cache_h */
@@ -0,0 +1,521 @@
+//
+//  texture_compression.h
+//  Graphics Engine
+//
+//  Copyright © 2017 Tony. All rights reserved.
+//
+
+#ifndef texture_compression_h
+#define texture_compression_h
+
+#include <glad/glad.h>
+
+#include "mipmap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+using namespace std;
+
+// S3TC and BPTC are extensions to GL 3.3, so the loader doesn't define them
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#endif
+
+// How a texture is block compressed.
+enum TextureCompression {
+    TEXTURE_COMPRESS_COLOR,       // BC1 for RGB, BC7 (BC3 without BPTC) for RGBA, BC4/BC5 for one or two channels
+    TEXTURE_COMPRESS_TWO_CHANNEL, // BC5 of red and green only, for maps whose other channels the shader doesn't need
+    TEXTURE_COMPRESS_NONE         // 8 bits per channel as decoded
+};
+
+// block compression formats the context samples, besides RGTC (BC4/BC5) which is core since GL 3.0
+const unsigned int TEXTURE_SUPPORT_S3TC = 1; // BC1, BC3
+const unsigned int TEXTURE_SUPPORT_BPTC = 2; // BC7
+
+// the formats of TEXTURE_SUPPORT_* the current context has, call on the context thread
+unsigned int queryTextureCompressionSupport()
+{
+    unsigned int supported = 0;
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; i++)
+    {
+        const char* name = (const char*)glGetStringi(GL_EXTENSIONS, i);
+        if (!name)
+            continue;
+        if (strcmp(name, "GL_EXT_texture_compression_s3tc") == 0)
+            supported |= TEXTURE_SUPPORT_S3TC;
+        else if (strcmp(name, "GL_ARB_texture_compression_bptc") == 0)
+            supported |= TEXTURE_SUPPORT_BPTC;
+    }
+    return supported;
+}
+
+// the compressed internal format an image with `components` channels gets, 0 to keep it uncompressed
+unsigned int compressedTextureFormat(TextureCompression compression, int components, unsigned int supported)
+{
+    if (compression == TEXTURE_COMPRESS_NONE)
+        return 0;
+    if (components == 1)
+        return GL_COMPRESSED_RED_RGTC1;
+    if (components == 2 || compression == TEXTURE_COMPRESS_TWO_CHANNEL)
+        return GL_COMPRESSED_RG_RGTC2;
+    if (components == 3)
+    {
+        if (supported & TEXTURE_SUPPORT_S3TC)
+            return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        return (supported & TEXTURE_SUPPORT_BPTC) ? GL_COMPRESSED_RGBA_BPTC_UNORM : 0;
+    }
+    if (supported & TEXTURE_SUPPORT_BPTC)
+        return GL_COMPRESSED_RGBA_BPTC_UNORM;
+    return (supported & TEXTURE_SUPPORT_S3TC) ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : 0;
+}
+
+// bytes per 4x4 block of a compressed format
+int compressedBlockBytes(unsigned int format)
+{
+    if (format == GL_COMPRESSED_RED_RGTC1 || format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT)
+        return 8;
+    return 16;
+}
+
+// Encoders of single 4x4 blocks, from 16 RGBA pixels in row order. They fit endpoints along the principal axis of
+// the block's colors and pick the closest palette entry per pixel, no exhaustive search: fast enough to compress a
+// texture on its first load, and the result is cached (see TextureCache).
+namespace BlockEncoder {
+
+    // direction of largest variance of `count`-channel points, by power iteration on their covariance
+    inline void principalAxis(const float points[16][4], int count, float mean[4], float axis[4])
+    {
+        for (int c = 0; c < count; c++)
+        {
+            mean[c] = 0.0f;
+            for (int i = 0; i < 16; i++)
+                mean[c] += points[i][c];
+            mean[c] /= 16.0f;
+        }
+        float covariance[4][4] = {};
+        for (int i = 0; i < 16; i++)
+            for (int a = 0; a < count; a++)
+                for (int b = 0; b < count; b++)
+                    covariance[a][b] += (points[i][a] - mean[a]) * (points[i][b] - mean[b]);
+        for (int c = 0; c < count; c++)
+            axis[c] = 1.0f;
+        for (int iteration = 0; iteration < 8; iteration++)
+        {
+            float next[4] = {};
+            float length = 0.0f;
+            for (int a = 0; a < count; a++)
+            {
+                for (int b = 0; b < count; b++)
+                    next[a] += covariance[a][b] * axis[b];
+                length = std::max(length, std::fabs(next[a]));
+            }
+            if (length == 0.0f)
+                return; // flat block, any axis will do
+            for (int c = 0; c < count; c++)
+                axis[c] = next[c] / length;
+        }
+    }
+
+    // the block's extremes along its principal axis
+    inline void fitEndpoints(const float points[16][4], int count, float low[4], float high[4])
+    {
+        float mean[4], axis[4];
+        principalAxis(points, count, mean, axis);
+        float minT = 0.0f, maxT = 0.0f;
+        for (int i = 0; i < 16; i++)
+        {
+            float t = 0.0f;
+            for (int c = 0; c < count; c++)
+                t += (points[i][c] - mean[c]) * axis[c];
+            minT = std::min(minT, t);
+            maxT = std::max(maxT, t);
+        }
+        for (int c = 0; c < count; c++)
+        {
+            low[c] = std::min(std::max(mean[c] + minT * axis[c], 0.0f), 255.0f);
+            high[c] = std::min(std::max(mean[c] + maxT * axis[c], 0.0f), 255.0f);
+        }
+    }
+
+    inline uint16_t packRGB565(const float color[4])
+    {
+        int r = (int)(color[0] * 31.0f / 255.0f + 0.5f);
+        int g = (int)(color[1] * 63.0f / 255.0f + 0.5f);
+        int b = (int)(color[2] * 31.0f / 255.0f + 0.5f);
+        return (uint16_t)((r << 11) | (g << 5) | b);
+    }
+
+    inline void unpackRGB565(uint16_t packed, int color[3])
+    {
+        int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+        color[0] = (r << 3) | (r >> 2);
+        color[1] = (g << 2) | (g >> 4);
+        color[2] = (b << 3) | (b >> 2);
+    }
+
+    // endpoints minimizing the squared error of the pixels blended between them with `weights` (0 = low, 1 = high)
+    inline bool refineEndpoints(const float points[16][4], int count, const float weights[16], float low[4], float high[4])
+    {
+        float aa = 0.0f, ab = 0.0f, bb = 0.0f, ax[4] = {}, bx[4] = {};
+        for (int i = 0; i < 16; i++)
+        {
+            float a = 1.0f - weights[i], b = weights[i];
+            aa += a * a;
+            ab += a * b;
+            bb += b * b;
+            for (int c = 0; c < count; c++)
+            {
+                ax[c] += a * points[i][c];
+                bx[c] += b * points[i][c];
+            }
+        }
+        float determinant = aa * bb - ab * ab;
+        if (std::fabs(determinant) < 1e-6f)
+            return false; // every pixel on one weight
+        for (int c = 0; c < count; c++)
+        {
+            low[c] = std::min(std::max((bb * ax[c] - ab * bx[c]) / determinant, 0.0f), 255.0f);
+            high[c] = std::min(std::max((aa * bx[c] - ab * ax[c]) / determinant, 0.0f), 255.0f);
+        }
+        return true;
+    }
+
+    // closest of the four colors between color0 and color1 per pixel, returns the squared error
+    inline int pickBC1Indices(const unsigned char pixels[16][4], uint16_t color0, uint16_t color1, uint32_t &indices)
+    {
+        int palette[4][3];
+        unpackRGB565(color0, palette[0]);
+        unpackRGB565(color1, palette[1]);
+        for (int c = 0; c < 3; c++)
+        {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+        indices = 0;
+        int total = 0;
+        for (int i = 0; i < 16; i++)
+        {
+            int best = 0, bestError = INT32_MAX;
+            for (int p = 0; p < (color0 == color1 ? 1 : 4); p++)
+            {
+                int error = 0;
+                for (int c = 0; c < 3; c++)
+                {
+                    int d = pixels[i][c] - palette[p][c];
+                    error += d * d;
+                }
+                if (error < bestError)
+                {
+                    bestError = error;
+                    best = p;
+                }
+            }
+            indices |= (uint32_t)best << (2 * i);
+            total += bestError;
+        }
+        return total;
+    }
+
+    // BC1 endpoints for colors `high` and `low`, color0 > color1 selects the four color mode
+    inline void quantizeBC1(const float high[4], const float low[4], uint16_t &color0, uint16_t &color1)
+    {
+        color0 = packRGB565(high);
+        color1 = packRGB565(low);
+        if (color0 < color1)
+            std::swap(color0, color1);
+    }
+
+    // BC1 in its four color mode (also the color half of BC3), alpha is ignored
+    inline void encodeBC1(const unsigned char pixels[16][4], unsigned char* block)
+    {
+        float points[16][4];
+        for (int i = 0; i < 16; i++)
+            for (int c = 0; c < 3; c++)
+                points[i][c] = pixels[i][c];
+        float low[4], high[4];
+        fitEndpoints(points, 3, low, high);
+        uint16_t color0, color1;
+        quantizeBC1(high, low, color0, color1);
+        uint32_t indices;
+        int error = pickBC1Indices(pixels, color0, color1, indices);
+
+        // one least squares pass over the endpoints, kept if it lowers the error
+        static const float paletteWeights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f }; // of color0
+        float weights[16];
+        for (int i = 0; i < 16; i++)
+            weights[i] = paletteWeights[(indices >> (2 * i)) & 3];
+        if (color0 != color1 && refineEndpoints(points, 3, weights, low, high))
+        {
+            uint16_t refined0, refined1;
+            uint32_t refinedIndices;
+            quantizeBC1(high, low, refined0, refined1);
+            int refinedError = pickBC1Indices(pixels, refined0, refined1, refinedIndices);
+            if (refinedError < error)
+            {
+                color0 = refined0;
+                color1 = refined1;
+                indices = refinedIndices;
+            }
+        }
+
+        block[0] = (unsigned char)(color0 & 0xff);
+        block[1] = (unsigned char)(color0 >> 8);
+        block[2] = (unsigned char)(color1 & 0xff);
+        block[3] = (unsigned char)(color1 >> 8);
+        for (int b = 0; b < 4; b++)
+            block[4 + b] = (unsigned char)(indices >> (8 * b));
+    }
+
+    // BC4 in its eight value mode, one channel (the alpha half of BC3, each half of BC5)
+    inline void encodeBC4(const unsigned char values[16], unsigned char* block)
+    {
+        int low = 255, high = 0;
+        for (int i = 0; i < 16; i++)
+        {
+            low = std::min(low, (int)values[i]);
+            high = std::max(high, (int)values[i]);
+        }
+        block[0] = (unsigned char)high;
+        block[1] = (unsigned char)low;
+        uint64_t indices = 0;
+        if (high > low)
+        {
+            // palette entries 0 and 1 are the endpoints, 2..7 step from high to low
+            int palette[8] = { high, low };
+            for (int p = 2; p < 8; p++)
+                palette[p] = ((8 - p) * high + (p - 1) * low) / 7;
+            for (int i = 0; i < 16; i++)
+            {
+                int best = 0, bestError = 256;
+                for (int p = 0; p < 8; p++)
+                {
+                    int error = std::abs(values[i] - palette[p]);
+                    if (error < bestError)
+                    {
+                        bestError = error;
+                        best = p;
+                    }
+                }
+                indices |= (uint64_t)best << (3 * i);
+            }
+        }
+        for (int b = 0; b < 6; b++)
+            block[2 + b] = (unsigned char)(indices >> (8 * b));
+    }
+
+    inline void encodeChannel(const unsigned char pixels[16][4], int channel, unsigned char* block)
+    {
+        unsigned char values[16];
+        for (int i = 0; i < 16; i++)
+            values[i] = pixels[i][channel];
+        encodeBC4(values, block);
+    }
+
+    // appends `count` bits of `value` to a little endian bit stream
+    inline void writeBits(unsigned char* block, int &position, uint32_t value, int count)
+    {
+        for (int i = 0; i < count; i++, position++)
+            if (value & (1u << i))
+                block[position >> 3] |= (unsigned char)(1 << (position & 7));
+    }
+
+    const int BC7_WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+    // BC7 mode 6 endpoints: 7 bits per channel plus the low bit that fits each endpoint best
+    inline void quantizeBC7(const float fitted[2][4], int endpoints[2][4], int pbits[2])
+    {
+        for (int e = 0; e < 2; e++)
+        {
+            float bestError = 1e30f;
+            for (int p = 0; p < 2; p++)
+            {
+                int quantized[4];
+                float error = 0.0f;
+                for (int c = 0; c < 4; c++)
+                {
+                    quantized[c] = std::min(std::max((int)std::floor((fitted[e][c] - p) / 2.0f + 0.5f), 0), 127);
+                    float d = (float)((quantized[c] << 1) | p) - fitted[e][c];
+                    error += d * d;
+                }
+                if (error < bestError)
+                {
+                    bestError = error;
+                    pbits[e] = p;
+                    memcpy(endpoints[e], quantized, sizeof(quantized));
+                }
+            }
+        }
+    }
+
+    // closest of the 16 colors between the endpoints per pixel, returns the squared error
+    inline int pickBC7Indices(const unsigned char pixels[16][4], const int endpoints[2][4], const int pbits[2], int indices[16])
+    {
+        int palette[16][4];
+        for (int w = 0; w < 16; w++)
+            for (int c = 0; c < 4; c++)
+            {
+                int a = (endpoints[0][c] << 1) | pbits[0], b = (endpoints[1][c] << 1) | pbits[1];
+                palette[w][c] = ((64 - BC7_WEIGHTS[w]) * a + BC7_WEIGHTS[w] * b + 32) >> 6;
+            }
+        int total = 0;
+        for (int i = 0; i < 16; i++)
+        {
+            int bestError = INT32_MAX;
+            for (int w = 0; w < 16; w++)
+            {
+                int error = 0;
+                for (int c = 0; c < 4; c++)
+                {
+                    int d = pixels[i][c] - palette[w][c];
+                    error += d * d;
+                }
+                if (error < bestError)
+                {
+                    bestError = error;
+                    indices[i] = w;
+                }
+            }
+            total += bestError;
+        }
+        return total;
+    }
+
+    // BC7 mode 6: one subset, RGBA endpoints of 7 bits plus a shared low bit each, 4 bit indices
+    inline void encodeBC7(const unsigned char pixels[16][4], unsigned char* block)
+    {
+        float points[16][4];
+        for (int i = 0; i < 16; i++)
+            for (int c = 0; c < 4; c++)
+                points[i][c] = pixels[i][c];
+        float fitted[2][4];
+        fitEndpoints(points, 4, fitted[0], fitted[1]);
+        int endpoints[2][4], pbits[2], indices[16];
+        quantizeBC7(fitted, endpoints, pbits);
+        int error = pickBC7Indices(pixels, endpoints, pbits, indices);
+
+        // one least squares pass over the endpoints, kept if it lowers the error
+        float weights[16];
+        for (int i = 0; i < 16; i++)
+            weights[i] = BC7_WEIGHTS[indices[i]] / 64.0f;
+        if (refineEndpoints(points, 4, weights, fitted[0], fitted[1]))
+        {
+            int refined[2][4], refinedPbits[2], refinedIndices[16];
+            quantizeBC7(fitted, refined, refinedPbits);
+            if (pickBC7Indices(pixels, refined, refinedPbits, refinedIndices) < error)
+            {
+                memcpy(endpoints, refined, sizeof(refined));
+                memcpy(pbits, refinedPbits, sizeof(refinedPbits));
+                memcpy(indices, refinedIndices, sizeof(refinedIndices));
+            }
+        }
+
+        // the first pixel's index is stored without its top bit, so it must be below 8
+        if (indices[0] >= 8)
+        {
+            std::swap(endpoints[0], endpoints[1]);
+            std::swap(pbits[0], pbits[1]);
+            for (int i = 0; i < 16; i++)
+                indices[i] = 15 - indices[i];
+        }
+
+        memset(block, 0, 16);
+        int position = 0;
+        writeBits(block, position, 1u << 6, 7); // mode 6
+        for (int c = 0; c < 4; c++)
+        {
+            writeBits(block, position, endpoints[0][c], 7);
+            writeBits(block, position, endpoints[1][c], 7);
+        }
+        writeBits(block, position, pbits[0], 1);
+        writeBits(block, position, pbits[1], 1);
+        writeBits(block, position, indices[0], 3);
+        for (int i = 1; i < 16; i++)
+            writeBits(block, position, indices[i], 4);
+    }
+
+    // one block of `format`
+    inline void encode(unsigned int format, const unsigned char pixels[16][4], unsigned char* block)
+    {
+        switch (format)
+        {
+            case GL_COMPRESSED_RED_RGTC1:
+                encodeChannel(pixels, 0, block);
+                break;
+            case GL_COMPRESSED_RG_RGTC2:
+                encodeChannel(pixels, 0, block);
+                encodeChannel(pixels, 1, block + 8);
+                break;
+            case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+                encodeBC1(pixels, block);
+                break;
+            case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+                encodeChannel(pixels, 3, block);
+                encodeBC1(pixels, block + 8);
+                break;
+            default:
+                encodeBC7(pixels, block);
+                break;
+        }
+    }
+}
+
+// Compresses every level of an 8 bit image into `format` (see compressedTextureFormat). Blocks that hang over the
+// edge of a level repeat its last row and column.
+void compressTexture(const TextureImage &image, unsigned int format, TextureImage &compressed)
+{
+    compressed.width = image.width;
+    compressed.height = image.height;
+    compressed.components = image.components;
+    compressed.format = format;
+    compressed.blockBytes = compressedBlockBytes(format);
+    compressed.levels.resize(image.levels.size());
+    size_t total = 0;
+    for (size_t l = 0; l < image.levels.size(); l++)
+    {
+        compressed.levels[l].width = image.levels[l].width;
+        compressed.levels[l].height = image.levels[l].height;
+        compressed.levels[l].offset = total;
+        total += compressed.levelSize(l);
+    }
+    compressed.pixels.assign(total, 0);
+
+    int components = image.components;
+    for (size_t l = 0; l < image.levels.size(); l++)
+    {
+        const MipLevel &level = image.levels[l];
+        const unsigned char* source = image.level(l);
+        unsigned char* destination = &compressed.pixels[compressed.levels[l].offset];
+        unsigned char pixels[16][4];
+        for (int by = 0; by < compressed.rowCount(l); by++)
+        {
+            for (int bx = 0; bx < (level.width + 3) / 4; bx++)
+            {
+                for (int i = 0; i < 16; i++)
+                {
+                    int x = std::min(bx * 4 + (i & 3), level.width - 1);
+                    int y = std::min(by * 4 + (i >> 2), level.height - 1);
+                    const unsigned char* pixel = source + ((size_t)y * level.width + x) * components;
+                    // missing channels as GL fills them in when sampling
+                    for (int c = 0; c < 4; c++)
+                        pixels[i][c] = c < components ? pixel[c] : (c == 3 ? 255 : 0);
+                }
+                BlockEncoder::encode(format, pixels, destination);
+                destination += compressed.blockBytes;
+            }
+        }
+    }
+}
+
+#endif /* texture_compression_h */
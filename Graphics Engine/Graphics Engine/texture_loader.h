@@ -0,0 +1,272 @@
+//
+//  texture_loader.h
+//  Graphics Engine
+//
+//  Copyright © 2017 Tony. All rights reserved.
+//
+
+#ifndef texture_loader_h
+#define texture_loader_h
+
+#include <glad/glad.h>
+
+#include "stb_image.h"
+#include "gl_state.h"
+#include "load_stats.h"
+#include "thread_pool.h"
+#include "mipmap.h"
+#include "texture_arrays.h"
+#include "texture_cache.h"
+#include "texture_compression.h"
+#include "texture_streamer.h"
+
+#include <chrono>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Sampling state of a loaded texture.
+struct TextureOptions {
+    GLint wrap;
+    GLint minFilter;
+    GLint magFilter;
+    bool flipVertically;
+    TextureCompression compression;
+    MipFilter mipFilter;
+    bool srgb; // the image is gamma encoded color, its mips are filtered in linear light
+    bool packed; // goes to a layer of a texture array shared with images like it (see TextureArrays)
+
+    TextureOptions() : wrap(GL_REPEAT), minFilter(GL_LINEAR_MIPMAP_LINEAR), magFilter(GL_LINEAR), flipVertically(false),
+                       compression(TEXTURE_COMPRESS_COLOR), mipFilter(MIP_FILTER_KAISER), srgb(true), packed(false) {}
+};
+
+// Image data produced by a decode job.
+struct DecodedImage {
+    bool loaded;
+    TextureImage image; // with its mip chain, block compressed unless the format isn't supported
+    double decodeMs;
+};
+
+// Loads textures in two stages: images are decoded (and their mip chains built) on the thread pool, then streamed
+// into GL on the context thread within a per-frame upload budget (see TextureStreamer).
+// Images are mipmapped and block compressed once and read from their TextureCache after that, which skips decoding
+// and mip generation entirely.
+// load() returns a usable texture name right away, a 1x1 white placeholder until the real image lands in the same
+// texture object, so nothing holding the name has to be patched up.
+class TextureLoader
+{
+public:
+    static TextureLoader& instance()
+    {
+        static TextureLoader loader;
+        return loader;
+    }
+
+    // queues a texture for loading and returns its name, must be called on the context thread. `contentHash` is the
+    // file's hashBytes if the caller already knows it, so the decode job doesn't hash the file again
+    unsigned int load(const string &path, const TextureOptions &options = TextureOptions(), const uint64_t* contentHash = NULL)
+    {
+        unsigned int textureID;
+        glGenTextures(1, &textureID);
+        GLState::instance().selectTexture(TEXTURE_UPLOAD_UNIT, GL_TEXTURE_2D, textureID);
+        const unsigned char white[4] = { 255, 255, 255, 255 };
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, options.wrap);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, options.wrap);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, options.minFilter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, options.magFilter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0); // keeps the placeholder complete under mipmap filters
+
+        Request request;
+        request.textureID = textureID;
+        request.path = path;
+        request.options = options;
+        if (supportedCompression < 0)
+            supportedCompression = (int)queryTextureCompressionSupport();
+        DecodeSettings settings;
+        settings.flip = options.flipVertically;
+        settings.compression = compressionEnabled ? options.compression : TEXTURE_COMPRESS_NONE;
+        settings.mipFilter = options.mipFilter;
+        settings.srgb = options.srgb;
+        settings.supported = (unsigned int)supportedCompression;
+        settings.hashKnown = contentHash != NULL;
+        settings.hash = contentHash ? *contentHash : 0;
+        request.image = ThreadPool::shared().enqueue([path, settings]() { return decode(path, settings); });
+        requests.push_back(std::move(request));
+        return textureID;
+    }
+
+    // hands finished decodes to the streamer and uploads up to the frame's budget,
+    // call once per frame on the context thread
+    void update()
+    {
+        for (size_t i = 0; i < requests.size(); )
+        {
+            if (requests[i].image.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            {
+                i++;
+                continue;
+            }
+            stream(requests[i]);
+            requests.erase(requests.begin() + i);
+        }
+        streamer.update();
+        completeLayers();
+    }
+
+    // waits for and uploads all queued textures, ignoring the budget
+    void finish()
+    {
+        for (size_t i = 0; i < requests.size(); i++)
+            stream(requests[i]);
+        requests.clear();
+        streamer.flush();
+        completeLayers();
+    }
+
+    // bytes uploaded per frame at most
+    void setUploadBudget(size_t bytes)
+    {
+        streamer.setBudget(bytes);
+    }
+
+    size_t pending() const
+    {
+        return requests.size() + streamer.pending();
+    }
+
+    // forgets a texture that is about to be deleted: its decode is thrown away when done and nothing more is uploaded
+    // into it or its array layer. call before deleting the texture or releasing its layer (see TextureRegistry)
+    void cancel(unsigned int textureID)
+    {
+        for (size_t i = 0; i < requests.size(); i++)
+        {
+            if (requests[i].textureID == textureID)
+            {
+                requests.erase(requests.begin() + i);
+                break;
+            }
+        }
+        streamer.cancel(textureID);
+    }
+
+    // false uploads every texture loaded from now on uncompressed, whatever its options say
+    void setCompressionEnabled(bool enabled)
+    {
+        compressionEnabled = enabled;
+    }
+
+private:
+    struct Request {
+        unsigned int textureID;
+        string path;
+        TextureOptions options;
+        std::future<DecodedImage> image;
+    };
+
+    // what a decode job makes of an image
+    struct DecodeSettings {
+        bool flip;
+        TextureCompression compression;
+        MipFilter mipFilter;
+        bool srgb;
+        unsigned int supported; // TEXTURE_SUPPORT_*
+        bool hashKnown;
+        uint64_t hash;          // of the file when hashKnown
+    };
+
+    vector<Request> requests;
+    TextureStreamer streamer;
+    bool compressionEnabled;
+    int supportedCompression; // TEXTURE_SUPPORT_* of the context, -1 until the first load asks for it
+
+    TextureLoader() : compressionEnabled(true), supportedCompression(-1) {}
+
+    // runs on a worker thread. stb_image's flip setting is global, so flipping is done here per image instead
+    static DecodedImage decode(const string &path, const DecodeSettings &settings)
+    {
+        DecodedImage decoded;
+        decoded.decodeMs = 0.0;
+        {
+            LoadTimer timer(decoded.decodeMs);
+            TextureCacheKey key;
+            bool cacheable = key.read(path, settings.compression, settings.mipFilter, settings.flip, settings.srgb,
+                                      settings.hashKnown ? &settings.hash : NULL);
+            decoded.loaded = cacheable && !ignoreLoadCaches()
+                && TextureCache::read(TextureCache::pathFor(path, key), key, settings.supported, decoded.image);
+            if (!decoded.loaded)
+                decodeAndCompress(path, settings, cacheable ? &key : NULL, decoded);
+        }
+        return decoded;
+    }
+
+    // decodes the image and builds its mip chain, then block compresses it if the context can sample its format,
+    // and caches the result
+    static void decodeAndCompress(const string &path, const DecodeSettings &settings, const TextureCacheKey* cacheKey, DecodedImage &decoded)
+    {
+        int width, height, components;
+        unsigned char* pixels = stbi_load(path.c_str(), &width, &height, &components, 0);
+        decoded.loaded = pixels != NULL;
+        if (!pixels)
+            return;
+        if (settings.flip)
+            flipRows(pixels, width, height, components);
+        buildMipChain(pixels, width, height, components, decoded.image, settings.mipFilter, settings.srgb);
+        stbi_image_free(pixels);
+
+        unsigned int format = compressedTextureFormat(settings.compression, components, settings.supported);
+        if (format)
+        {
+            TextureImage image = std::move(decoded.image);
+            compressTexture(image, format, decoded.image);
+        }
+        if (cacheKey)
+            TextureCache::write(TextureCache::pathFor(path, *cacheKey), *cacheKey, decoded.image);
+    }
+
+    static void flipRows(unsigned char* pixels, int width, int height, int components)
+    {
+        size_t stride = (size_t)width * components;
+        vector<unsigned char> row(stride);
+        for (int y = 0; y < height / 2; y++)
+        {
+            unsigned char* top = pixels + y * stride;
+            unsigned char* bottom = pixels + (height - 1 - y) * stride;
+            memcpy(&row[0], top, stride);
+            memcpy(top, bottom, stride);
+            memcpy(bottom, &row[0], stride);
+        }
+    }
+
+    void stream(Request &request)
+    {
+        DecodedImage decoded = request.image.get();
+        modelLoadStats().decodeMs += decoded.decodeMs;
+        if (!decoded.loaded)
+        {
+            std::cout << "Texture failed to load at path: " << request.path << std::endl;
+            return;
+        }
+        if (request.options.packed)
+        {
+            const TextureOptions &options = request.options;
+            const TextureLayer &layer = TextureArrays::instance().allocate(request.textureID, decoded.image, options.wrap, options.minFilter, options.magFilter);
+            streamer.queue(request.textureID, decoded.image, layer.array, layer.layer);
+        }
+        else
+            streamer.queue(request.textureID, decoded.image);
+    }
+
+    // packed textures get sampled from their layer once it's complete
+    void completeLayers()
+    {
+        vector<unsigned int> completed = streamer.takeCompletedLayers();
+        for (size_t i = 0; i < completed.size(); i++)
+            TextureArrays::instance().layerComplete(completed[i]);
+    }
+};
+
+#endif /* texture_loader_h */
@@ -0,0 +1,190 @@
+//
+//  texture_registry.h
+//  Graphics Engine
+//
+//  Copyright © 2017 Tony. All rights reserved.
+//
+
+#ifndef texture_registry_h
+#define texture_registry_h
+
+#include <glad/glad.h>
+
+#include "mapped_file.h"
+#include "texture_loader.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// All textures loaded from files, shared by everything that asks for the same image with the same options.
+// A request is matched first by the path as given, then by its canonical path (realpath) and finally by the file's
+// contents, so the same image in two folders is decoded and uploaded only once. Contents are only hashed on the
+// context thread when another texture's file has the same size, and that hash is handed to the loader so its decode
+// job doesn't hash the file again for the TextureCache key. Each acquire() takes a reference that has to be given
+// back with release(); the texture is deleted with the last one.
+class TextureRegistry
+{
+public:
+    static TextureRegistry& instance()
+    {
+        static TextureRegistry registry;
+        return registry;
+    }
+
+    // returns the texture for an image file, loading it (see TextureLoader) if nobody holds it yet
+    unsigned int acquire(const string &path, const TextureOptions &options = TextureOptions())
+    {
+        string optionKey = optionsKey(options);
+        unordered_map<string, unsigned int>::iterator alias = aliases.find(optionKey + path);
+        if (alias != aliases.end())
+            return addReference(alias->second);
+
+        string canonical = canonicalPath(path);
+        unordered_map<string, unsigned int>::iterator found = byPath.find(optionKey + canonical);
+        if (found != byPath.end())
+            return addAlias(found->second, optionKey + path);
+
+        // only a file of the same size as one already loaded with the same options can have the same contents
+        FileStamp stamp;
+        string sizeKey;
+        bool hashed = false;
+        uint64_t contentHash = 0;
+        if (stamp.read(canonical))
+        {
+            sizeKey = optionKey + std::to_string(stamp.size);
+            unordered_map<string, vector<unsigned int> >::iterator sameSize = bySize.find(sizeKey);
+            if (sameSize != bySize.end())
+            {
+                hashed = hashFile(canonical, contentHash);
+                for (size_t i = 0; hashed && i < sameSize->second.size(); i++)
+                {
+                    unsigned int candidate = sameSize->second[i];
+                    Entry &other = entries[candidate];
+                    if (!other.hashed)
+                        other.hashed = hashFile(other.file, other.contentHash);
+                    if (other.hashed && other.contentHash == contentHash)
+                    {
+                        other.pathKeys.push_back(optionKey + canonical);
+                        byPath[optionKey + canonical] = candidate;
+                        return addAlias(candidate, optionKey + path);
+                    }
+                }
+            }
+        }
+
+        unsigned int textureID = TextureLoader::instance().load(path, options, hashed ? &contentHash : NULL);
+        Entry &entry = entries[textureID];
+        entry.references = 0;
+        entry.hashed = hashed;
+        entry.contentHash = contentHash;
+        entry.file = canonical;
+        entry.sizeKey = sizeKey;
+        entry.pathKeys.push_back(optionKey + canonical);
+        byPath[optionKey + canonical] = textureID;
+        if (!sizeKey.empty())
+            bySize[sizeKey].push_back(textureID);
+        return addAlias(textureID, optionKey + path);
+    }
+
+    // gives back a reference taken by acquire()
+    void release(unsigned int textureID)
+    {
+        unordered_map<unsigned int, Entry>::iterator it = entries.find(textureID);
+        if (it == entries.end())
+        {
+            std::cout << "ERROR::TEXTURE_REGISTRY:: release of unknown texture " << textureID << std::endl;
+            return;
+        }
+        Entry &entry = it->second;
+        if (--entry.references > 0)
+            return;
+        for (size_t i = 0; i < entry.aliasKeys.size(); i++)
+            aliases.erase(entry.aliasKeys[i]);
+        for (size_t i = 0; i < entry.pathKeys.size(); i++)
+            byPath.erase(entry.pathKeys[i]);
+        if (!entry.sizeKey.empty())
+        {
+            vector<unsigned int> &sameSize = bySize[entry.sizeKey];
+            sameSize.erase(std::find(sameSize.begin(), sameSize.end(), textureID));
+            if (sameSize.empty())
+                bySize.erase(entry.sizeKey);
+        }
+        entries.erase(it);
+        TextureLoader::instance().cancel(textureID);
+        TextureArrays::instance().release(textureID);
+        GLState::instance().deleteTexture(textureID);
+    }
+
+    // number of distinct textures alive
+    size_t size() const
+    {
+        return entries.size();
+    }
+
+private:
+    struct Entry {
+        unsigned int references;
+        bool hashed;                // contentHash is known, files are only hashed once a file of the same size shows up
+        uint64_t contentHash;       // hashBytes of the file, as in TextureCacheKey
+        string file;                // canonical path
+        string sizeKey;             // key into bySize, empty if the file couldn't be read
+        vector<string> pathKeys;    // keys into byPath
+        vector<string> aliasKeys;   // keys into aliases
+    };
+
+    unordered_map<unsigned int, Entry> entries;
+    unordered_map<string, unsigned int> aliases;   // options + path as requested
+    unordered_map<string, unsigned int> byPath;    // options + canonical path
+    unordered_map<string, vector<unsigned int> > bySize; // options + file size
+
+    TextureRegistry() {}
+
+    unsigned int addReference(unsigned int textureID)
+    {
+        entries[textureID].references++;
+        return textureID;
+    }
+
+    unsigned int addAlias(unsigned int textureID, const string &key)
+    {
+        if (aliases.insert(std::make_pair(key, textureID)).second)
+            entries[textureID].aliasKeys.push_back(key);
+        return addReference(textureID);
+    }
+
+    // textures loaded with different options are different textures
+    static string optionsKey(const TextureOptions &options)
+    {
+        char key[64];
+        snprintf(key, sizeof(key), "%x:%x:%x:%d:%d:%d:%d:%d|", options.wrap, options.minFilter, options.magFilter, options.flipVertically ? 1 : 0,
+                 (int)options.compression, (int)options.mipFilter, options.srgb ? 1 : 0, options.packed ? 1 : 0);
+        return key;
+    }
+
+    static string canonicalPath(const string &path)
+    {
+        char resolved[PATH_MAX];
+        if (realpath(path.c_str(), resolved))
+            return resolved;
+        return path;
+    }
+
+    static bool hashFile(const string &path, uint64_t &hash)
+    {
+        MappedFile file;
+        if (!file.open(path))
+            return false;
+        hash = hashBytes(file.data(), file.size());
+        return true;
+    }
+};
+
+#endif /* texture_registry_h */
@@ -0,0 +1,328 @@
+//
+//  texture_streamer.h
+//  Graphics Engine
+//
+//  Copyright © 2017 Tony. All rights reserved.
+//
+
+#ifndef texture_streamer_h
+#define texture_streamer_h
+
+#include <glad/glad.h>
+
+#include "gl_state.h"
+#include "load_stats.h"
+#include "mipmap.h"
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <vector>
+using namespace std;
+
+// pixel transfer format of an 8 bit image with the given number of channels
+GLenum textureFormat(int components)
+{
+    if (components == 1)
+        return GL_RED;
+    if (components == 2)
+        return GL_RG;
+    if (components == 4)
+        return GL_RGBA;
+    return GL_RGB;
+}
+
+// Uploads rows [row, row + rows) of a level from `data` (client memory or an offset into the bound unpack buffer),
+// block rows of 4 pixel rows for compressed images. The first band of a level that is split allocates the level
+// with the unpack buffer unbound, so nothing is read from it. With a `layer` the rows go to that layer of the bound
+// GL_TEXTURE_2D_ARRAY, whose levels are allocated already (see TextureArrays).
+void uploadTextureRows(const TextureImage &image, int level, int row, int rows, const void* data, unsigned int unpackBuffer, int layer = -1)
+{
+    const MipLevel &size = image.levels[level];
+    GLenum format = textureFormat(image.components);
+    bool whole = row == 0 && rows == image.rowCount(level);
+    GLsizei bytes = (GLsizei)(rows * image.rowBytes(level));
+    if (layer >= 0)
+    {
+        if (image.format)
+            glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, row * 4, layer, size.width, image.rowHeight(level, row, rows), 1, image.format, bytes, data);
+        else
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, row, layer, size.width, rows, 1, format, GL_UNSIGNED_BYTE, data);
+        return;
+    }
+    if (whole)
+    {
+        if (image.format)
+            glCompressedTexImage2D(GL_TEXTURE_2D, level, image.format, size.width, size.height, 0, bytes, data);
+        else
+            glTexImage2D(GL_TEXTURE_2D, level, format, size.width, size.height, 0, format, GL_UNSIGNED_BYTE, data);
+        return;
+    }
+    if (row == 0)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        if (image.format)
+            glCompressedTexImage2D(GL_TEXTURE_2D, level, image.format, size.width, size.height, 0, (GLsizei)image.levelSize(level), NULL);
+        else
+            glTexImage2D(GL_TEXTURE_2D, level, format, size.width, size.height, 0, format, GL_UNSIGNED_BYTE, NULL);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, unpackBuffer);
+    }
+    if (image.format)
+        glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, row * 4, size.width, image.rowHeight(level, row, rows), image.format, bytes, data);
+    else
+        glTexSubImage2D(GL_TEXTURE_2D, level, 0, row, size.width, rows, format, GL_UNSIGNED_BYTE, data);
+}
+
+// Streams mip chains into textures through a ring of pixel buffer objects, at most `budget` bytes per frame.
+// Levels are uploaded smallest first and a level is split into bands of rows (of blocks, for block compressed
+// images) when it doesn't fit in what is left of the frame's budget. GL_TEXTURE_BASE_LEVEL follows the largest
+// complete level, so a texture is always complete and just gets sharper while it streams in. Layers of texture
+// arrays share their array's levels, so they are only reported (takeCompletedLayers) once all of their levels are in.
+//
+// GL 3.3 has no persistently mapped buffers, so every frame maps the next PBO of the ring with
+// GL_MAP_INVALIDATE_BUFFER_BIT; a fence per PBO tells when the GPU is done reading it. If it is still busy the frame
+// skips its uploads instead of waiting.
+class TextureStreamer
+{
+public:
+    TextureStreamer(size_t budget = 4 << 20) : budget(budget), bufferSize(0), nextBuffer(0)
+    {
+        for (int i = 0; i < RING_SIZE; i++)
+        {
+            buffers[i] = 0;
+            fences[i] = 0;
+        }
+    }
+
+    // bytes uploaded per frame at most, takes effect on the next update()
+    void setBudget(size_t bytes)
+    {
+        budget = std::max(bytes, (size_t)MIN_BUDGET);
+    }
+
+    size_t getBudget() const
+    {
+        return budget;
+    }
+
+    // takes over the image, the texture keeps sampling what it has until the first level arrives. with an `array`
+    // the image goes to its `layer` instead of to the texture. the texture (and its layer) must stay alive until the
+    // upload is done or cancel()ed
+    void queue(unsigned int textureID, TextureImage &image, unsigned int array = 0, int layer = -1)
+    {
+        jobs.push_back(Job());
+        Job &job = jobs.back();
+        job.textureID = textureID;
+        job.array = array;
+        job.layer = layer;
+        job.image = std::move(image);
+        job.level = (int)job.image.levels.size() - 1;
+        job.row = 0;
+    }
+
+    // drops what is left to upload of a texture, call before deleting it or giving up its layer. rows that were
+    // already issued still land, GL orders them before whatever reuses the texture or layer
+    void cancel(unsigned int textureID)
+    {
+        for (size_t j = 0; j < jobs.size(); )
+        {
+            if (jobs[j].textureID == textureID)
+                jobs.erase(jobs.begin() + j);
+            else
+                j++;
+        }
+        completedLayers.erase(std::remove(completedLayers.begin(), completedLayers.end(), textureID), completedLayers.end());
+    }
+
+    // uploads up to the budget, call once per frame on the context thread
+    void update()
+    {
+        if (jobs.empty())
+            return;
+        LoadTimer timer(modelLoadStats().uploadMs);
+        createBuffers();
+
+        int slot = nextBuffer;
+        if (fences[slot])
+        {
+            // the GPU may still be reading this buffer, try again next frame
+            if (glClientWaitSync(fences[slot], 0, 0) == GL_TIMEOUT_EXPIRED)
+                return;
+            glDeleteSync(fences[slot]);
+            fences[slot] = 0;
+        }
+        nextBuffer = (slot + 1) % RING_SIZE;
+
+        // copy as many rows as fit into the buffer
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[slot]);
+        unsigned char* mapped = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bufferSize, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (!mapped)
+        {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            return;
+        }
+        chunks.clear();
+        size_t used = 0;
+        for (size_t j = 0; j < jobs.size() && used < bufferSize; )
+        {
+            Job &job = jobs[j];
+            size_t rowSize = job.image.rowBytes(job.level);
+            int rows = (int)std::min((size_t)(job.image.rowCount(job.level) - job.row), (bufferSize - used) / rowSize);
+            if (rows == 0)
+                break;
+            memcpy(mapped + used, job.image.level(job.level) + job.row * rowSize, rows * rowSize);
+            Chunk chunk = { job.level, job.row, rows, used, (int)j };
+            chunks.push_back(chunk);
+            used += rows * rowSize;
+            if (!advance(job, rows))
+                j++;
+        }
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+        // then let the driver pull them from the buffer
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (size_t i = 0; i < chunks.size(); i++)
+        {
+            const Chunk &chunk = chunks[i];
+            const Job &job = jobs[chunk.job];
+            bindTarget(job);
+            uploadTextureRows(job.image, chunk.level, chunk.row, chunk.rows, (void*)chunk.offset, buffers[slot], job.layer);
+            if (chunk.row + chunk.rows == job.image.rowCount(chunk.level))
+                levelComplete(job, chunk.level);
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+        // retire finished textures
+        for (size_t j = 0; j < jobs.size(); )
+        {
+            if (jobs[j].level < 0)
+                jobs.erase(jobs.begin() + j);
+            else
+                j++;
+        }
+    }
+
+    // uploads everything that is queued right away, straight from client memory
+    void flush()
+    {
+        LoadTimer timer(modelLoadStats().uploadMs);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (size_t j = 0; j < jobs.size(); j++)
+        {
+            Job &job = jobs[j];
+            bindTarget(job);
+            for (; job.level >= 0; job.level--)
+            {
+                int rows = job.image.rowCount(job.level) - job.row;
+                uploadTextureRows(job.image, job.level, job.row, rows, job.image.level(job.level) + job.row * job.image.rowBytes(job.level), 0, job.layer);
+                job.row = 0;
+                levelComplete(job, job.level);
+            }
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        jobs.clear();
+    }
+
+    size_t pending() const
+    {
+        return jobs.size();
+    }
+
+    // the textures whose array layers were completed since the last call
+    vector<unsigned int> takeCompletedLayers()
+    {
+        vector<unsigned int> completed;
+        completed.swap(completedLayers);
+        return completed;
+    }
+
+private:
+    static const int RING_SIZE = 3;
+    static const size_t MIN_BUDGET = 64 << 10;
+
+    struct Job {
+        unsigned int textureID;
+        unsigned int array; // with a layer >= 0, the GL_TEXTURE_2D_ARRAY the image goes to
+        int layer;
+        TextureImage image;
+        int level; // next level to upload, counting down to 0; -1 once done
+        int row;   // next row of that level, see TextureImage::rowCount
+    };
+
+    struct Chunk {
+        int level, row, rows;
+        size_t offset;
+        int job;
+    };
+
+    size_t budget;
+    size_t bufferSize;
+    unsigned int buffers[RING_SIZE];
+    GLsync fences[RING_SIZE];
+    int nextBuffer;
+    deque<Job> jobs;
+    vector<Chunk> chunks;
+    vector<unsigned int> completedLayers;
+
+    // (re)creates the ring when the budget changed
+    void createBuffers()
+    {
+        if (bufferSize == budget)
+            return;
+        for (int i = 0; i < RING_SIZE; i++)
+        {
+            if (fences[i])
+                glDeleteSync(fences[i]);
+            fences[i] = 0;
+        }
+        if (buffers[0])
+            glDeleteBuffers(RING_SIZE, buffers);
+        glGenBuffers(RING_SIZE, buffers);
+        for (int i = 0; i < RING_SIZE; i++)
+        {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[i]);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, budget, NULL, GL_STREAM_DRAW);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        bufferSize = budget;
+    }
+
+    // moves a job past `rows` uploaded rows, returns false once the whole chain is done
+    static bool advance(Job &job, int rows)
+    {
+        job.row += rows;
+        if (job.row == job.image.rowCount(job.level))
+        {
+            job.row = 0;
+            job.level--;
+        }
+        return job.level >= 0;
+    }
+
+    static void bindTarget(const Job &job)
+    {
+        if (job.layer >= 0)
+            GLState::instance().selectTexture(TEXTURE_UPLOAD_UNIT, GL_TEXTURE_2D_ARRAY, job.array);
+        else
+            GLState::instance().selectTexture(TEXTURE_UPLOAD_UNIT, GL_TEXTURE_2D, job.textureID);
+    }
+
+    // makes a freshly completed level the one that gets sampled, the job's texture is bound
+    void levelComplete(const Job &job, int level)
+    {
+        int levelCount = (int)job.image.levels.size();
+        if (job.layer >= 0)
+        {
+            if (level == 0)
+                completedLayers.push_back(job.textureID);
+            return;
+        }
+        if (level == levelCount - 1)
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+    }
+};
+
+#endif /* texture_streamer_h */
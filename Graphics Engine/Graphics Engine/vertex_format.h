@@ -0,0 +1,286 @@
+//
+//  vertex_format.h
+//  Graphics Engine
+//
+//  Copyright © 2017 Tony. All rights reserved.
+//
+
+#ifndef vertex_format_h
+#define vertex_format_h
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+using namespace std;
+
+struct Vertex {
+    // position
+    glm::vec3 Position;
+    // normal
+    glm::vec3 Normal;
+    // texCoords
+    glm::vec2 TexCoords;
+    // tangent
+    glm::vec3 Tangent;
+    // bitangent
+    glm::vec3 Bitangent;
+};
+
+// Encoding of the vertex buffers meshes create. The packed encoding needs a vertex shader compiled with PACKED_VERTEX
+// (see model_loading.vs) and holds only positions and texture coordinates, see formatAttributes.
+enum VertexFormat {
+    VERTEX_FULL,   // floats, as in Vertex
+    VERTEX_PACKED  // quantized, see VertexLayout
+};
+
+// format used by meshes created from now on
+VertexFormat& meshVertexFormat()
+{
+    static VertexFormat format = VERTEX_FULL;
+    return format;
+}
+
+// whether meshes created from now on keep their positions in a buffer of their own, so position-only passes
+// (depth pre-pass, shadows, occlusion) fetch 12 bytes per vertex (8 packed) instead of the whole vertex
+bool& meshPositionStreams()
+{
+    static bool split = false;
+    return split;
+}
+
+// Attributes a vertex buffer holds besides the position, which is always there.
+const unsigned int ATTRIBUTE_NORMAL = 1;
+const unsigned int ATTRIBUTE_TEXCOORDS = 2;
+const unsigned int ATTRIBUTE_TANGENTS = 4; // tangent and bitangent
+const unsigned int ATTRIBUTES_ALL = ATTRIBUTE_NORMAL | ATTRIBUTE_TEXCOORDS | ATTRIBUTE_TANGENTS;
+
+// the attributes a mesh keeps in a format: packed vertices are for shaders that only read positions and texture
+// coordinates (the model shaders), so they have no encoding for normals and tangents
+unsigned int formatAttributes(unsigned int attributes, VertexFormat format)
+{
+    return format == VERTEX_PACKED ? attributes & ATTRIBUTE_TEXCOORDS : attributes & ATTRIBUTES_ALL;
+}
+
+// Bounds packed positions are relative to: position = offset + unorm16 * scale.
+struct PositionQuantization {
+    glm::vec3 offset, scale;
+};
+
+// IEEE half from a float, rounded to nearest; overflows become infinity
+uint16_t floatToHalf(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, 4);
+    uint32_t sign = (bits >> 16) & 0x8000;
+    int exponent = (int)((bits >> 23) & 0xFF) - 127 + 15;
+    uint32_t mantissa = bits & 0x7FFFFF;
+    if (((bits >> 23) & 0xFF) == 0xFF)
+        return (uint16_t)(sign | 0x7C00 | (mantissa ? 0x200 : 0)); // inf or nan
+    if (exponent >= 31)
+        return (uint16_t)(sign | 0x7C00);
+    if (exponent <= 0)
+    {
+        if (exponent < -10)
+            return (uint16_t)sign;
+        // subnormal
+        mantissa |= 0x800000;
+        uint32_t shift = (uint32_t)(14 - exponent);
+        uint32_t half = mantissa >> shift;
+        if ((mantissa >> (shift - 1)) & 1)
+            half++;
+        return (uint16_t)(sign | half);
+    }
+    uint32_t half = sign | ((uint32_t)exponent << 10) | (mantissa >> 13);
+    if (mantissa & 0x1000)
+        half++; // may carry into the exponent, which still rounds correctly
+    return (uint16_t)half;
+}
+
+// the bounds of a mesh's positions
+PositionQuantization quantizePositions(const Vertex* vertices, size_t count)
+{
+    glm::vec3 lower(0.0f), upper(0.0f);
+    if (count > 0)
+        lower = upper = vertices[0].Position;
+    for (size_t i = 1; i < count; i++)
+    {
+        lower = glm::min(lower, vertices[i].Position);
+        upper = glm::max(upper, vertices[i].Position);
+    }
+    PositionQuantization quantization;
+    quantization.offset = lower;
+    quantization.scale = upper - lower;
+    for (int c = 0; c < 3; c++)
+        if (quantization.scale[c] == 0.0f)
+            quantization.scale[c] = 1.0f;
+    return quantization;
+}
+
+// An interleaved vertex layout holding only the attributes in `Attributes`, as floats or packed:
+//                 full          packed
+//   position      float x3      unorm16 x4 relative to the mesh bounds (w is padding)
+//   normal        float x3      -
+//   texCoords     float x2      half float x2
+//   tangents      float x3 x2   -
+// A packed layout leaves out the normal and tangents even when `Attributes` has them (see formatAttributes).
+// Stride, offsets and attribute pointers are resolved at compile time for every specialization, so attributes a
+// shader doesn't read are neither stored nor fetched. Without `Position` the layout is the attribute stream of a
+// mesh whose positions live in a buffer of their own, VertexLayout<0, Packed> being that position stream.
+template <unsigned int Attributes, bool Packed, bool Position = true>
+struct VertexLayout {
+    static constexpr bool hasNormal = !Packed && (Attributes & ATTRIBUTE_NORMAL) != 0;
+    static constexpr bool hasTexCoords = (Attributes & ATTRIBUTE_TEXCOORDS) != 0;
+    static constexpr bool hasTangents = !Packed && (Attributes & ATTRIBUTE_TANGENTS) != 0;
+    static constexpr size_t normalOffset = Position ? (Packed ? 8 : 12) : 0;
+    static constexpr size_t texCoordsOffset = normalOffset + (hasNormal ? 12 : 0);
+    static constexpr size_t tangentsOffset = texCoordsOffset + (hasTexCoords ? (Packed ? 4 : 8) : 0);
+    static constexpr size_t stride = tangentsOffset + (hasTangents ? 24 : 0);
+    static constexpr bool identity = !Packed && Position && Attributes == ATTRIBUTES_ALL; // same bytes as Vertex
+
+    static void write(const Vertex &vertex, const PositionQuantization &quantization, unsigned char* out)
+    {
+        if (Packed)
+        {
+            if (Position)
+            {
+                uint16_t position[4] = { 0, 0, 0, 0 };
+                for (int c = 0; c < 3; c++)
+                {
+                    float unit = (vertex.Position[c] - quantization.offset[c]) / quantization.scale[c];
+                    position[c] = (uint16_t)std::floor(std::max(0.0f, std::min(1.0f, unit)) * 65535.0f + 0.5f);
+                }
+                memcpy(out, position, sizeof(position));
+            }
+            if (hasTexCoords)
+            {
+                uint16_t texCoords[2] = { floatToHalf(vertex.TexCoords.x), floatToHalf(vertex.TexCoords.y) };
+                memcpy(out + texCoordsOffset, texCoords, sizeof(texCoords));
+            }
+        }
+        else
+        {
+            if (Position)
+                memcpy(out, &vertex.Position, sizeof(glm::vec3));
+            if (hasNormal)
+                memcpy(out + normalOffset, &vertex.Normal, sizeof(glm::vec3));
+            if (hasTexCoords)
+                memcpy(out + texCoordsOffset, &vertex.TexCoords, sizeof(glm::vec2));
+            if (hasTangents)
+            {
+                memcpy(out + tangentsOffset, &vertex.Tangent, sizeof(glm::vec3));
+                memcpy(out + tangentsOffset + sizeof(glm::vec3), &vertex.Bitangent, sizeof(glm::vec3));
+            }
+        }
+    }
+
+    // attribute pointers of the bound vertex array into the bound GL_ARRAY_BUFFER
+    static void setAttributePointers()
+    {
+        if (Position)
+        {
+            glEnableVertexAttribArray(0);
+            if (Packed)
+                glVertexAttribPointer(0, 4, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)0);
+            else
+                glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+        }
+        if (hasNormal)
+        {
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)normalOffset);
+        }
+        if (hasTexCoords)
+        {
+            glEnableVertexAttribArray(2);
+            glVertexAttribPointer(2, 2, Packed ? GL_HALF_FLOAT : GL_FLOAT, GL_FALSE, stride, (void*)texCoordsOffset);
+        }
+        if (hasTangents)
+        {
+            glEnableVertexAttribArray(3);
+            glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, stride, (void*)tangentsOffset);
+            glEnableVertexAttribArray(4);
+            glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, stride, (void*)(tangentsOffset + sizeof(glm::vec3)));
+        }
+    }
+
+    // lays out `count` vertices, count * stride bytes
+    static void writeVertices(const Vertex* vertices, size_t count, const PositionQuantization &quantization, unsigned char* out)
+    {
+        if (identity)
+        {
+            // no need to interleave
+            memcpy(out, vertices, count * sizeof(Vertex));
+            return;
+        }
+        for (size_t i = 0; i < count; i++)
+            write(vertices[i], quantization, out + i * stride);
+    }
+};
+
+template <unsigned int Attributes, bool Packed, bool Position> constexpr size_t VertexLayout<Attributes, Packed, Position>::normalOffset;
+template <unsigned int Attributes, bool Packed, bool Position> constexpr size_t VertexLayout<Attributes, Packed, Position>::texCoordsOffset;
+template <unsigned int Attributes, bool Packed, bool Position> constexpr size_t VertexLayout<Attributes, Packed, Position>::tangentsOffset;
+template <unsigned int Attributes, bool Packed, bool Position> constexpr size_t VertexLayout<Attributes, Packed, Position>::stride;
+template <unsigned int Attributes, bool Packed, bool Position> constexpr bool VertexLayout<Attributes, Packed, Position>::identity;
+
+// A VertexLayout specialization chosen at runtime.
+struct VertexLayoutInfo {
+    size_t stride;
+    bool identity; // the vertices can be uploaded as they are
+    void (*writeVertices)(const Vertex* vertices, size_t count, const PositionQuantization &quantization, unsigned char* out);
+    void (*setAttributePointers)(); // into the bound GL_ARRAY_BUFFER, for the bound vertex array
+};
+
+// selects the VertexLayout specialization for a key of attributes | (packed ? 8 : 0) | (no position ? 16 : 0),
+// counting down from Key
+template <unsigned int Key>
+struct VertexLayoutDispatch {
+    static VertexLayoutInfo find(unsigned int key)
+    {
+        if (key != Key)
+            return VertexLayoutDispatch<Key - 1>::find(key);
+        typedef VertexLayout<Key & ATTRIBUTES_ALL, (Key & 8) != 0, (Key & 16) == 0> Layout;
+        VertexLayoutInfo info = { Layout::stride, Layout::identity, &Layout::writeVertices, &Layout::setAttributePointers };
+        return info;
+    }
+};
+
+template <>
+struct VertexLayoutDispatch<0> {
+    static VertexLayoutInfo find(unsigned int)
+    {
+        typedef VertexLayout<0, false> Layout;
+        VertexLayoutInfo info = { Layout::stride, Layout::identity, &Layout::writeVertices, &Layout::setAttributePointers };
+        return info;
+    }
+};
+
+// the layout of vertices with only the given attributes. without `position` it's the attribute stream of a mesh whose
+// positions are laid out by vertexLayout(0, format) in a buffer of their own (12 bytes a vertex, 8 packed)
+VertexLayoutInfo vertexLayout(unsigned int attributes, VertexFormat format, bool position = true)
+{
+    unsigned int key = (attributes & ATTRIBUTES_ALL) | (format == VERTEX_PACKED ? 8 : 0) | (position ? 0 : 16);
+    return VertexLayoutDispatch<31>::find(key);
+}
+
+// the attributes a linked program reads, by the names the model shaders use:
+// aNormal, aTexCoords and aTangent/aBitangent
+unsigned int shaderVertexAttributes(unsigned int program)
+{
+    unsigned int attributes = 0;
+    if (glGetAttribLocation(program, "aNormal") >= 0)
+        attributes |= ATTRIBUTE_NORMAL;
+    if (glGetAttribLocation(program, "aTexCoords") >= 0)
+        attributes |= ATTRIBUTE_TEXCOORDS;
+    if (glGetAttribLocation(program, "aTangent") >= 0 || glGetAttribLocation(program, "aBitangent") >= 0)
+        attributes |= ATTRIBUTE_TANGENTS;
+    return attributes;
+}
+
+#endif /* vertex_format_h */
@@ -43,8 +43,10 @@ void main(void) {
     float refractiveFactor = dot(viewVector, vec3(0, 1, 0));
     refractiveFactor = pow(refractiveFactor, 1);
     
-    vec4 normalMapColor = texture(normalMap, distortedTexCoords);
-    vec3 normal = vec3(normalMapColor.r * 2 - 1, normalMapColor.b, normalMapColor.g * 2 -1);
+    // the normal map is stored as two channels (BC5), its blue channel follows from the normal being unit length
+    vec2 normalMapColor = texture(normalMap, distortedTexCoords).rg * 2 - 1;
+    float normalMapBlue = sqrt(max(1 - dot(normalMapColor, normalMapColor), 0)) * 0.5 + 0.5;
+    vec3 normal = vec3(normalMapColor.r, normalMapBlue, normalMapColor.g);
     normal = normalize(normal);
     
     vec3 reflectLight = reflect(normalize(fromLightVector), normal);